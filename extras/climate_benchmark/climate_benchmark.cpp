@@ -0,0 +1,176 @@
+// Host microbenchmark for publishing climate readings, comparing formatting a
+// double (how ArduinoJson serialises a float/double value) with formatting the
+// fixed-point tenths directly, which only needs integer work.
+//
+// Build and run on the host with:
+//   g++ -O2 -o climate_benchmark climate_benchmark.cpp && ./climate_benchmark
+//
+// The double path below follows ArduinoJson's float formatting (normalise,
+// split into integral and 9 decimal digits, round, strip trailing zeros). On
+// the host that double maths runs on a hardware FPU. The ESP32 has no double
+// precision FPU, so there every one of those operations is a soft-float
+// library call, and the gap is wider than measured here.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#define ITERATIONS 10000000L
+
+// Keep the compiler from optimising the loops away
+volatile int16_t _sensorTemperature = 214;
+volatile int16_t _sensorHumidity = 486;
+volatile char _sink;
+
+char *_formatUnsigned(char *p, uint32_t value)
+{
+  char digits[10];
+  int count = 0;
+  do
+  {
+    digits[count++] = '0' + value % 10;
+    value /= 10;
+  } while (value);
+
+  while (count)
+  {
+    *p++ = digits[--count];
+  }
+  return p;
+}
+
+// Double: tenths to double, then formatted the way ArduinoJson does
+void _formatDouble(char *buffer, double value)
+{
+  char *p = buffer;
+  if (value < 0)
+  {
+    *p++ = '-';
+    value = -value;
+  }
+
+  // Normalise (climate readings never need it, but the checks still run)
+  int exponent = 0;
+  while (value >= 1e7)
+  {
+    value /= 10;
+    exponent++;
+  }
+  while (value > 0 && value < 1e-5)
+  {
+    value *= 10;
+    exponent--;
+  }
+
+  uint32_t integral = (uint32_t)value;
+  double remainder = (value - integral) * 1e9;
+  uint32_t decimal = (uint32_t)remainder;
+  remainder -= decimal;
+
+  if (remainder >= 0.5)
+  {
+    decimal++;
+    if (decimal >= 1000000000)
+    {
+      decimal = 0;
+      integral++;
+    }
+  }
+
+  int places = 9;
+  while (places > 0 && decimal % 10 == 0)
+  {
+    decimal /= 10;
+    places--;
+  }
+
+  p = _formatUnsigned(p, integral);
+  if (places > 0)
+  {
+    *p++ = '.';
+    char digits[10];
+    char *end = _formatUnsigned(digits, decimal);
+    for (int i = end - digits; i < places; i++)
+    {
+      *p++ = '0';
+    }
+    memcpy(p, digits, end - digits);
+    p += end - digits;
+  }
+
+  if (exponent)
+  {
+    *p++ = 'e';
+    p += sprintf(p, "%d", exponent);
+  }
+  *p = '\0';
+}
+
+// Fixed-point: _formatDeci() from OXRS_WT32.cpp, with itoa() swapped for a
+// portable equivalent
+void _formatDeci(char *buffer, int16_t value)
+{
+  char *p = buffer;
+  int32_t absValue = value;
+
+  if (absValue < 0)
+  {
+    *p++ = '-';
+    absValue = -absValue;
+  }
+
+  p = _formatUnsigned(p, absValue / 10);
+  *p++ = '.';
+  *p++ = '0' + absValue % 10;
+  *p = '\0';
+}
+
+void _doubleClimate(void)
+{
+  char buffer[24];
+  _formatDouble(buffer, _sensorTemperature / 10.0);
+  _sink = buffer[0];
+  _formatDouble(buffer, _sensorHumidity / 10.0);
+  _sink = buffer[0];
+}
+
+void _fixedClimate(void)
+{
+  char buffer[8];
+  _formatDeci(buffer, _sensorTemperature);
+  _sink = buffer[0];
+  _formatDeci(buffer, _sensorHumidity);
+  _sink = buffer[0];
+}
+
+double _benchmark(const char *name, void (*function)(void))
+{
+  auto start = std::chrono::steady_clock::now();
+  for (long i = 0; i < ITERATIONS; i++)
+  {
+    function();
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  double ns = std::chrono::duration<double, std::nano>(end - start).count() / ITERATIONS;
+  printf("%-8s %6.2f ns/reading\n", name, ns);
+  return ns;
+}
+
+int main(void)
+{
+  // Both must produce the same text
+  char doubleText[24];
+  char fixedText[8];
+  _formatDouble(doubleText, _sensorTemperature / 10.0);
+  _formatDeci(fixedText, _sensorTemperature);
+  printf("double \"%s\", fixed \"%s\"\n", doubleText, fixedText);
+
+  double doubleNs = _benchmark("double", _doubleClimate);
+  double fixedNs = _benchmark("fixed", _fixedClimate);
+
+  printf("fixed-point is %.2fx the speed of double\n", doubleNs / fixedNs);
+  return 0;
+}
@@ -9,6 +9,14 @@
 #include <WiFi.h>         // Required for Ethernet to get MAC
 #include <MqttLogger.h>   // For logging
 #include <LittleFS.h>     // For file system access
+#include <esp_heap_caps.h> // For PSRAM allocations
+#include <inttypes.h>     // For PRIx32
+
+#include "WT32Hash.h"     // For FNV-1a hashing
+#include "WT32Gzip.h"     // For payload compression
+#include "WT32Schema.h"   // For payload validation
+#include "WT32Http.h"     // For peeking at REST requests
+#include "WT32Ota.h"      // For OTA firmware updates
 
 #if defined(WIFI_MODE)
 #include <WiFiManager.h>  // For WiFi AP config
@@ -42,294 +50,2152 @@ OXRS_MQTT _mqtt(_mqttClient);
 // REST API
 OXRS_API _api(_mqtt);
 
-// Logging (topic updated once MQTT connects successfully)
-MqttLogger _logger(_mqttClient, "log", MqttLoggerMode::MqttAndSerial);
+// MQTT reconnect backoff, jittered so a fleet of devices that lose the broker
+// at the same moment (e.g. a power cut) don't all reconnect at once
+uint32_t _mqttReconnectDelayMs = MQTT_RECONNECT_MIN_MS;
+uint32_t _mqttReconnectWaitMs = 0L;
+uint32_t _mqttReconnectLastMs = 0L;
+uint32_t _mqttJitterState = 1;
 
-// Supported firmware config and command schemas
-JsonDocument _fwConfigSchema;
-JsonDocument _fwCommandSchema;
+// MQTT disconnect counts, indexed by PubSubClient state (from MQTT_CONNECTION_TIMEOUT)
+#define MQTT_STATE_COUNT (MQTT_CONNECT_UNAUTHORIZED - MQTT_CONNECTION_TIMEOUT + 1)
+uint16_t _mqttDisconnectCounts[MQTT_STATE_COUNT];
 
-// MQTT callbacks wrapped by _mqttConfig/_mqttCommand
-jsonCallback _onConfig;
-jsonCallback _onCommand;
+// Logging (topic updated once MQTT connects successfully)
+MqttLogger _mqttLogger(_mqttClient, "log", MqttLoggerMode::MqttAndSerial);
 
-// local variables
-char _fwVersion[40] = "<No Version>";
+// Log store page buffer, held in RAM until the file system is mounted
+// so boot/network logging is captured too
+uint8_t _logBuffer[LOG_PAGE_BYTES];
+size_t _logBufferLength = 0;
+uint32_t _logBufferStart = 0L;
+boolean _logStoreReady = false;
 
-// SHT20 climate sensor
-SHT2x sht;
+// Tees everything logged to the MQTT logger and the on-flash log store
+class WT32Logger : public Print
+{
+public:
+  size_t write(uint8_t character);
+  using Print::write;
+};
 
-// call back to update climate values on screen
-climateUpdateCallback _onClimateUpdate;
+WT32Logger _logger;
 
-// Climate update interval - extend or disable climate updates via
-// the MQTT config option "climateUpdateSeconds" - zero to disable
-uint32_t _climateUpdateMs = DEFAULT_CLIMATE_UPDATE_MS;
+// Deferred log records (oldest dropped on overflow)
+typedef struct
+{
+  uint32_t timestamp;
+  const char *format;
+  int32_t arg;
+} logRecord_t;
+
+logRecord_t _logRing[LOG_RING_SIZE];
+uint8_t _logRingHead = 0;
+uint8_t _logRingCount = 0;
+uint32_t _logRingDropped = 0L;
+
+#if defined(HEAP_PROFILING)
+// Library call sites we profile heap usage for
+enum heapSite_t { HEAP_SITE_OTHER, HEAP_SITE_ADOPT, HEAP_SITE_CLIMATE, HEAP_SITE_MQTT_RECEIVE, HEAP_SITE_TELEMETRY, HEAP_SITE_COUNT };
+const char *_heapSiteNames[HEAP_SITE_COUNT] = {"other", "adopt", "climate", "mqttReceive", "telemetry"};
+
+typedef struct
+{
+  uint32_t calls;
+  uint32_t allocCount;
+  uint32_t allocBytes;
+  int32_t fragmentationDelta;
+} heapProfile_t;
 
-bool _sht20Found = false;
+heapProfile_t _heapProfile[HEAP_SITE_COUNT];
+heapSite_t _heapSite = HEAP_SITE_OTHER;
 
-// most recent climate data
-double _temperature = NAN;
-double _humidity = NAN;
+// Fragmentation index samples (taken each system health update), oldest first
+uint8_t _heapFragmentationTrend[HEAP_PROFILE_TREND_SIZE];
+uint8_t _heapFragmentationSamples = 0;
 
-/* JSON helpers */
-void _mergeJson(JsonVariant dst, JsonVariantConst src)
+// Percentage of free heap which is unavailable as a single allocation
+uint8_t _getHeapFragmentation(void)
 {
-  if (src.is<JsonObjectConst>())
+  uint32_t freeHeap = ESP.getFreeHeap();
+  return freeHeap ? 100 - (ESP.getMaxAllocHeap() * 100 / freeHeap) : 0;
+}
+
+// Attributes allocations to a call site for the lifetime of the scope, a
+// nested scope only counts the call, leaving its allocations (and change in
+// fragmentation) with the enclosing site so nothing is counted twice
+class HeapProfileScope
+{
+public:
+  HeapProfileScope(heapSite_t site)
   {
-    for (JsonPairConst kvp : src.as<JsonObjectConst>())
+    _heapProfile[site].calls++;
+
+    _nested = _heapSite != HEAP_SITE_OTHER;
+    if (!_nested)
     {
-      if (dst[kvp.key()])
-      {
-        _mergeJson(dst[kvp.key()], kvp.value());
-      }
-      else
-      {
-        dst[kvp.key()] = kvp.value();
-      }
+      _heapSite = site;
+      _fragmentation = _getHeapFragmentation();
     }
   }
-  else
+
+  ~HeapProfileScope()
   {
-    dst.set(src);
+    if (!_nested)
+    {
+      _heapProfile[_heapSite].fragmentationDelta += (int32_t)_getHeapFragmentation() - _fragmentation;
+      _heapSite = HEAP_SITE_OTHER;
+    }
   }
-}
 
-/* Adoption info builders */
-void _getFirmwareJson(JsonVariant json)
-{
-  JsonObject firmware = json["firmware"].to<JsonObject>();
+private:
+  boolean _nested;
+  uint8_t _fragmentation;
+};
 
-  firmware["name"] = FW_NAME;
-  firmware["shortName"] = FW_SHORT_NAME;
-  firmware["maker"] = FW_MAKER;
-  firmware["version"] = _fwVersion;
-#if defined(FW_HARDWARE)
-  firmware["hardware"] = STRINGIFY(FW_HARDWARE);
-#endif
-#if defined(FW_GITHUB_URL)
-  firmware["githubUrl"] = FW_GITHUB_URL;
+#define HEAP_PROFILE(site) HeapProfileScope _heapProfileScope(site)
+#else
+#define HEAP_PROFILE(site)
 #endif
-}
 
-void _getSystemJson(JsonVariant json)
+// ArduinoJson allocator for all library documents
+class WT32Allocator : public ArduinoJson::Allocator
 {
-  JsonObject system = json["system"].to<JsonObject>();
+public:
+  WT32Allocator(allocPolicy_t policy) : _policy(policy) {}
 
-  system["heapUsedBytes"] = ESP.getHeapSize();
-  system["heapFreeBytes"] = ESP.getFreeHeap();
-  system["heapMaxAllocBytes"] = ESP.getMaxAllocHeap();
-  system["flashChipSizeBytes"] = ESP.getFlashChipSize();
+  void *allocate(size_t size) override
+  {
+    _profile(size);
 
-  system["sketchSpaceUsedBytes"] = ESP.getSketchSize();
-  system["sketchSpaceTotalBytes"] = ESP.getFreeSketchSpace();
+    void *ptr = NULL;
+    if (_policy == ALLOC_PSRAM)
+    {
+      ptr = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    }
 
-  system["fileSystemUsedBytes"] = LittleFS.usedBytes();
-  system["fileSystemTotalBytes"] = LittleFS.totalBytes();
+    // Fall back to internal SRAM if no PSRAM (or it is full)
+    return ptr ? ptr : malloc(size);
+  }
 
-  system["availablePsRamBytes"] = ESP.getPsramSize();
-  system["freePsRamBytes"] = ESP.getFreePsram();
-}
+  void deallocate(void *ptr) override
+  {
+    free(ptr);
+  }
 
-void _getNetworkJson(JsonVariant json)
-{
-  JsonObject network = json["network"].to<JsonObject>();
+  void *reallocate(void *ptr, size_t size) override
+  {
+    _profile(size);
 
-  byte mac[6];
+    void *newPtr = NULL;
+    if (_policy == ALLOC_PSRAM)
+    {
+      newPtr = heap_caps_realloc(ptr, size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    }
 
-#if defined(ETH_MODE)
-  Ethernet.MACAddress(mac);
+    return newPtr ? newPtr : realloc(ptr, size);
+  }
 
-  network["mode"] = "ethernet";
-  network["ip"] = Ethernet.localIP();
-#else
-  WiFi.macAddress(mac);
+private:
+  allocPolicy_t _policy;
 
-  network["mode"] = "wifi";
-  network["ip"] = WiFi.localIP();
+  void _profile(size_t size)
+  {
+#if defined(HEAP_PROFILING)
+    _heapProfile[_heapSite].allocCount++;
+    _heapProfile[_heapSite].allocBytes += size;
 #endif
+  }
+};
 
-  char mac_display[18];
-  sprintf_P(mac_display, PSTR("%02X:%02X:%02X:%02X:%02X:%02X"), mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
-  network["mac"] = mac_display;
-}
+// Small, short lived, documents stay in internal SRAM - large/cold ones go in PSRAM
+WT32Allocator _jsonAllocator(ALLOC_INTERNAL);
+WT32Allocator _psRamAllocator(ALLOC_PSRAM);
 
-void _getConfigSchemaJson(JsonVariant json)
+// Supported firmware config and command schemas
+JsonDocument _fwConfigSchema(&_psRamAllocator);
+JsonDocument _fwCommandSchema(&_psRamAllocator);
+
+// MQTT callbacks wrapped by _mqttConfig/_mqttCommand
+jsonCallback _onConfig;
+jsonCallback _onCommand;
+jsonCallback _onConfigDelta;
+
+// Compiled config/command schemas, inbound payloads are validated against
+// these before being passed on - recompiled whenever the schemas change
+schemaProgram_t _configSchemaProgram;
+schemaProgram_t _commandSchemaProgram;
+boolean _schemaProgramsDirty = true;
+
+// Schema hashes (updated when the schemas are compiled), optionally
+// sent in adoption payloads instead of the full schemas
+uint32_t _configSchemaHash = 0L;
+uint32_t _commandSchemaHash = 0L;
+boolean _adoptSchemaHashes = false;
+
+// Set if the payload being received failed schema validation, so it is
+// reported as rejected (and never cached) even though it parsed ok
+boolean _payloadRejected = false;
+
+// Set while dispatching a payload one member at a time, which is opt-in
+// since the firmware then receives each member as a separate callback
+boolean _mqttStreaming = false;
+boolean _streamingMembers = false;
+
+// Hashed snapshot of the last applied config, per top-level key
+typedef struct
 {
-  JsonObject configSchema = json["configSchema"].to<JsonObject>();
+  uint32_t keyHash;
+  uint32_t valueHash;
+  char *key;
+  boolean removed;
+} configSnapshot_t;
 
-  // Config schema metadata
-  configSchema["$schema"] = JSON_SCHEMA_VERSION;
-  configSchema["title"] = FW_SHORT_NAME;
-  configSchema["type"] = "object";
+configSnapshot_t _configSnapshot[MAX_CONFIG_SNAPSHOT_KEYS];
 
-  JsonObject properties = configSchema["properties"].to<JsonObject>();
+// Config/command key handlers (open addressed hash tables, keyed on oxrsKeyHash)
+static_assert((MAX_KEY_HANDLERS & (MAX_KEY_HANDLERS - 1)) == 0, "MAX_KEY_HANDLERS must be a power of 2");
 
-  // Firmware config schema (if any)
-  if (!_fwConfigSchema.isNull())
+typedef struct
+{
+  uint32_t hash;
+  const char *key;
+  jsonCallback callback;
+} keyHandler_t;
+
+keyHandler_t _configKeyHandlers[MAX_KEY_HANDLERS];
+keyHandler_t _commandKeyHandlers[MAX_KEY_HANDLERS];
+
+// local variables
+char _fwVersion[40] = "<No Version>";
+
+// SHT20 climate sensor
+SHT2x sht;
+
+// call back to update climate values on screen
+climateUpdateCallback _onClimateUpdate;
+
+// Climate update interval - extend or disable climate updates via
+// the MQTT config option "climateUpdateSeconds" - zero to disable
+uint32_t _climateUpdateMs = DEFAULT_CLIMATE_UPDATE_MS;
+
+bool _sht20Found = false;
+
+// Cached file system usage (usedBytes() walks the file system metadata)
+size_t _fileSystemUsedBytes = 0;
+size_t _fileSystemTotalBytes = 0;
+boolean _fileSystemStatsValid = false;
+
+// System health telemetry interval - enable via the MQTT config
+// option "systemUpdateSeconds" - zero to disable
+uint32_t _systemUpdateMs = DEFAULT_SYSTEM_UPDATE_MS;
+
+// System stats as last reported, for delta encoding
+JsonDocument _lastSystemJson(&_jsonAllocator);
+
+// stat/ and tele/ payload encodings
+payloadFormat_t _statusFormat = FORMAT_JSON;
+payloadFormat_t _telemetryFormat = FORMAT_JSON;
+
+// Telemetry batching (disabled if max bytes is zero)
+uint16_t _telemetryBatchMaxBytes = 0;
+uint32_t _telemetryBatchMaxAgeMs = 0L;
+uint32_t _telemetryBatchStart = 0L;
+size_t _telemetryBatchBytes = 0;
+payloadFormat_t _telemetryBatchFormat = FORMAT_JSON;
+JsonDocument _telemetryBatch(&_psRamAllocator);
+
+// Telemetry raised by our (non-member) MQTT callbacks, published from loop()
+// via publishTelemetry() so it honours the telemetry format/batching
+JsonDocument _pendingTelemetry(&_jsonAllocator);
+
+// Offline telemetry spool - records are staged in RAM and appended to the
+// spool file in SPOOL_BUFFER_BYTES chunks, to keep flash writes to a minimum
+typedef struct __attribute__((packed))
+{
+  uint16_t magic;
+  uint16_t length;
+  uint32_t timestamp;
+  uint32_t checksum;
+} spoolRecordHeader_t;
+
+uint32_t _spoolMaxBytes = 0L;
+uint32_t _spoolFileBytes = 0L;
+uint32_t _spoolReadOffset = 0L;
+uint32_t _spoolBootOffset = 0L;
+uint32_t _spoolReplayed = 0L;
+uint32_t _spoolDropped = 0L;
+uint8_t _spoolRetries = 0;
+uint8_t _spoolBuffer[SPOOL_BUFFER_BYTES];
+size_t _spoolBufferLength = 0;
+uint32_t _spoolBufferStart = 0L;
+
+// All config applied so far (partial/streamed payloads merged per top-level
+// key) and the hash of what was last written to the cache file, so a retained
+// config redelivered on every reconnect doesn't rewrite it
+JsonDocument _configCache(&_psRamAllocator);
+uint32_t _configCacheHash = 0L;
+
+// Gzip compressed schemas, cached against their content hash
+typedef struct
+{
+  uint32_t hash;
+  uint8_t *data;
+  size_t length;
+} gzipCache_t;
+
+boolean _payloadCompression = false;
+
+// Set from the peeked request head, before the request is passed to the API
+boolean _requestAcceptsGzip = false;
+gzipCache_t _configSchemaGzip;
+gzipCache_t _commandSchemaGzip;
+
+// Adoption info version, bumped whenever the network info or payload formats
+// change (the schemas are versioned by their hashes), salted per boot so ETags
+// handed out before a restart are never mistaken for current ones
+uint32_t _adoptVersion = 0L;
+uint32_t _adoptEtagSalt = 0L;
+
+// Static assets, served straight from the file system
+const char *_staticPath = NULL;
+const char *_staticDirectory = NULL;
+
+// Boot timeline, when each begin() phase/sub-step finished (ms since power
+// on), logged at the end of begin() and published once we first connect
+typedef struct
+{
+  const char *step;
+  uint32_t ms;
+} bootStep_t;
+
+bootStep_t _bootTimeline[BOOT_TIMELINE_SIZE];
+uint8_t _bootTimelineCount = 0;
+boolean _bootTimelinePublished = false;
+
+// Status screen text, only re-queried/formatted when the network
+// link, DHCP lease or MQTT connection changes
+char _ipAddressTxt[16];
+char _macAddressTxt[18];
+char _mqttTopicTxt[40];
+boolean _statusTxtDirty = true;
+boolean _lastNetworkConnected = false;
+uint32_t _statusGeneration = 0;
+
+// Status change events, queued (oldest dropped on overflow) and
+// delivered to subscribers from loop()
+typedef struct
+{
+  wt32Event_t event;
+  int data;
+} eventQueueItem_t;
+
+eventQueueItem_t _eventQueue[EVENT_QUEUE_SIZE];
+uint8_t _eventQueueHead = 0;
+uint8_t _eventQueueCount = 0;
+eventCallback _eventSubscribers[MAX_EVENT_SUBSCRIBERS];
+
+// Last MQTT state we raised an event for (MQTT_CONNECTED or disconnect reason)
+int _lastMqttEventState = MQTT_DISCONNECTED;
+
+// most recent climate data, in fixed-point tenths (the ESP32 has
+// no double precision FPU), CLIMATE_INVALID if no valid reading
+#define CLIMATE_INVALID INT16_MIN
+int16_t _temperature = CLIMATE_INVALID;
+int16_t _humidity = CLIMATE_INVALID;
+
+/* Event helpers */
+void _queueEvent(wt32Event_t event, int data)
+{
+  if (_eventQueueCount == EVENT_QUEUE_SIZE)
   {
-    _mergeJson(properties, _fwConfigSchema.as<JsonVariant>());
+    _eventQueueHead = (_eventQueueHead + 1) % EVENT_QUEUE_SIZE;
+    _eventQueueCount--;
   }
 
-  // sensor config only if ESP is S3 or SHT20 found
-#if defined(CONFIG_IDF_TARGET_ESP32S3)
-  bool _s3Detected = true;
-#else
-  bool _s3Detected = false;
-#endif
+  eventQueueItem_t *item = &_eventQueue[(_eventQueueHead + _eventQueueCount) % EVENT_QUEUE_SIZE];
+  item->event = event;
+  item->data = data;
+  _eventQueueCount++;
+}
 
-  if (_s3Detected || _sht20Found)
+/* Boot timeline helpers */
+void _markBootStep(const char *step)
+{
+  if (_bootTimelineCount < BOOT_TIMELINE_SIZE)
   {
-    JsonObject climateUpdateSeconds = properties["climateUpdateSeconds"].to<JsonObject>();
-    climateUpdateSeconds["title"] = "Sensor Update Interval (seconds)";
-    climateUpdateSeconds["description"] = "How often to read and report the value from connected sensors (ESP32 internal temperature, SHT20) (defaults to 60 seconds, setting to 0 disables climate reports). Must be a number between 0 and 86400 (i.e. 1 day).";
-    climateUpdateSeconds["type"] = "integer";
-    climateUpdateSeconds["minimum"] = 0;
-    climateUpdateSeconds["maximum"] = 86400;
+    bootStep_t *item = &_bootTimeline[_bootTimelineCount++];
+    item->step = step;
+    item->ms = millis();
   }
 }
 
-void _getCommandSchemaJson(JsonVariant json)
+void _logBootTimeline(void)
 {
-  JsonObject commandSchema = json["commandSchema"].to<JsonObject>();
-  // Command schema metadata
-  commandSchema["$schema"] = JSON_SCHEMA_VERSION;
-  commandSchema["title"] = FW_SHORT_NAME;
-  commandSchema["type"] = "object";
+  uint32_t last = _bootTimeline[0].ms;
+  for (uint8_t i = 0; i < _bootTimelineCount; i++)
+  {
+    _logger.print(F("[wt32] boot "));
+    _logger.print(_bootTimeline[i].step);
+    _logger.print(F(": "));
+    _logger.print(_bootTimeline[i].ms - last);
+    _logger.print(F("ms (at "));
+    _logger.print(_bootTimeline[i].ms);
+    _logger.println(F("ms)"));
+    last = _bootTimeline[i].ms;
+  }
+}
 
-  JsonObject properties = commandSchema["properties"].to<JsonObject>();
+void _getBootTimelineJson(JsonVariant json)
+{
+  JsonObject bootTimeline = json["bootTimeline"].to<JsonObject>();
+  bootTimeline["startMs"] = _bootTimeline[0].ms;
 
-  // Firmware command schema (if any)
-  if (!_fwCommandSchema.isNull())
+  JsonArray steps = bootTimeline["steps"].to<JsonArray>();
+  uint32_t last = _bootTimeline[0].ms;
+  for (uint8_t i = 1; i < _bootTimelineCount; i++)
   {
-    _mergeJson(properties, _fwCommandSchema.as<JsonVariant>());
+    JsonObject step = steps.add<JsonObject>();
+    step["step"] = _bootTimeline[i].step;
+    step["ms"] = _bootTimeline[i].ms - last;
+    last = _bootTimeline[i].ms;
   }
 
-  // Restart command
-  JsonObject restart = properties["restart"].to<JsonObject>();
-  restart["title"] = "Restart";
-  restart["type"] = "boolean";
+  bootTimeline["totalMs"] = last - _bootTimeline[0].ms;
 }
 
-/* API callbacks */
-void _apiAdopt(JsonVariant json)
+/* Text formatting helpers (avoid the cost of sprintf) */
+char *_formatDec3(char *p, uint8_t value)
 {
-  // Build device adoption info
-  _getFirmwareJson(json);
-  _getSystemJson(json);
-  _getNetworkJson(json);
-  _getConfigSchemaJson(json);
-  _getCommandSchemaJson(json);
+  *p++ = '0' + value / 100;
+  *p++ = '0' + (value / 10) % 10;
+  *p++ = '0' + value % 10;
+  return p;
 }
 
-/* MQTT callbacks */
-void _mqttConnected()
+char *_formatHex2(char *p, uint8_t value)
 {
-  // MqttLogger doesn't copy the logging topic to an internal
-  // buffer so we have to use a static array here
-  static char logTopic[64];
-  _logger.setTopic(_mqtt.getLogTopic(logTopic));
+  static const char hex[] = "0123456789ABCDEF";
+  *p++ = hex[value >> 4];
+  *p++ = hex[value & 0x0F];
+  return p;
+}
 
-  // Publish device adoption info
-  JsonDocument json;
-  _mqtt.publishAdopt(_api.getAdopt(json.as<JsonVariant>()));
+// Formats as 000.000.000.000 (buffer must be at least 16 chars)
+void _formatIPAddress(char *buffer, IPAddress ip)
+{
+  char *p = buffer;
+  for (uint8_t i = 0; i < 4; i++)
+  {
+    if (i > 0)
+    {
+      *p++ = '.';
+    }
+    p = _formatDec3(p, ip[i]);
+  }
+  *p = '\0';
+}
 
-  // Log the fact we are now connected
-  _logger.println("[wt32] mqtt connected");
+// Formats as 00:00:00:00:00:00 (buffer must be at least 18 chars)
+void _formatMACAddress(char *buffer, byte *mac)
+{
+  char *p = buffer;
+  for (uint8_t i = 0; i < 6; i++)
+  {
+    if (i > 0)
+    {
+      *p++ = ':';
+    }
+    p = _formatHex2(p, mac[i]);
+  }
+  *p = '\0';
 }
 
-void _mqttDisconnected(int state)
+// Formats fixed-point tenths as -0.0 (buffer must be at least 8 chars)
+void _formatDeci(char *buffer, int16_t value)
 {
-  // Log the disconnect reason
-  // See https://github.com/knolleary/pubsubclient/blob/2d228f2f862a95846c65a8518c79f48dfc8f188c/src/PubSubClient.h#L44
-  switch (state)
+  char *p = buffer;
+  int32_t absValue = value;
+
+  if (absValue < 0)
   {
-  case MQTT_CONNECTION_TIMEOUT:
-    _logger.println(F("[wt32] mqtt connection timeout"));
-    break;
-  case MQTT_CONNECTION_LOST:
-    _logger.println(F("[wt32] mqtt connection lost"));
-    break;
-  case MQTT_CONNECT_FAILED:
-    _logger.println(F("[wt32] mqtt connect failed"));
-    break;
-  case MQTT_DISCONNECTED:
-    _logger.println(F("[wt32] mqtt disconnected"));
-    break;
-  case MQTT_CONNECT_BAD_PROTOCOL:
-    _logger.println(F("[wt32] mqtt bad protocol"));
-    break;
-  case MQTT_CONNECT_BAD_CLIENT_ID:
-    _logger.println(F("[wt32] mqtt bad client id"));
-    break;
-  case MQTT_CONNECT_UNAVAILABLE:
-    _logger.println(F("[wt32] mqtt unavailable"));
-    break;
-  case MQTT_CONNECT_BAD_CREDENTIALS:
-    _logger.println(F("[wt32] mqtt bad credentials"));
-    break;
-  case MQTT_CONNECT_UNAUTHORIZED:
-    _logger.println(F("[wt32] mqtt unauthorised"));
-    break;
+    *p++ = '-';
+    absValue = -absValue;
   }
+
+  itoa(absValue / 10, p, 10);
+  p += strlen(p);
+  *p++ = '.';
+  *p++ = '0' + absValue % 10;
+  *p = '\0';
 }
 
-void _mqttConfig(JsonVariant json)
+/* JSON helpers */
+void _mergeJson(JsonVariant dst, JsonVariantConst src)
 {
-  // SHT20 sensor config
-  if (json.containsKey("climateUpdateSeconds"))
+  if (src.is<JsonObjectConst>())
   {
-    _climateUpdateMs = json["climateUpdateSeconds"].as<uint32_t>() * 1000L;
-    if (_climateUpdateMs == 0)
+    for (JsonPairConst kvp : src.as<JsonObjectConst>())
     {
-      _temperature = NAN;
-      _humidity = NAN;
-      if (_onClimateUpdate)
+      if (dst[kvp.key()])
       {
-        _onClimateUpdate();
+        _mergeJson(dst[kvp.key()], kvp.value());
+      }
+      else
+      {
+        dst[kvp.key()] = kvp.value();
       }
     }
   }
-
-  // Pass on to the firmware callback
-  if (_onConfig)
+  else
   {
-    _onConfig(json);
+    dst.set(src);
   }
 }
 
-void _mqttCommand(JsonVariant json)
+// ArduinoJson reader over a single "key": value member of a payload, wrapped
+// in braces, so it deserialises as a one member object owning its own key
+class JsonMemberReader
 {
-  // Core restart command
-  if (json.containsKey("restart") && json["restart"].as<bool>())
+public:
+  JsonMemberReader(const char *member, const char *end) : _p(member), _end(end), _state(0) {}
+
+  int read(void)
   {
-    ESP.restart();
+    switch (_state)
+    {
+    case 0:
+      _state = 1;
+      return '{';
+    case 1:
+      if (_p < _end)
+      {
+        return (uint8_t)*_p++;
+      }
+      _state = 2;
+      return '}';
+    default:
+      return -1;
+    }
   }
 
-  // Pass on to the firmware callback
-  if (_onCommand)
+  size_t readBytes(char *buffer, size_t length)
   {
-    _onCommand(json);
+    size_t count = 0;
+    int c;
+    while (count < length && (c = read()) >= 0)
+    {
+      buffer[count++] = (char)c;
+    }
+    return count;
   }
+
+private:
+  const char *_p;
+  const char *_end;
+  uint8_t _state;
+};
+
+const char *_skipJsonWhitespace(const char *p, const char *end)
+{
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+  {
+    p++;
+  }
+  return p;
 }
 
-void _mqttCallback(char *topic, byte *payload, int length)
+// Returns a pointer to the end of the JSON value starting at p, or NULL if malformed
+const char *_skipJsonValue(const char *p, const char *end)
 {
-  // Pass down to our MQTT handler and check it was processed ok
-  int state = _mqtt.receive(topic, payload, length);
-  switch (state)
+  int depth = 0;
+
+  while (p < end)
+  {
+    char c = *p++;
+    if (c == '"')
+    {
+      while (p < end && *p != '"')
+      {
+        if (*p == '\\')
+        {
+          p++;
+        }
+        p++;
+      }
+
+      if (p >= end)
+      {
+        return NULL;
+      }
+      p++;
+    }
+    else if (c == '{' || c == '[')
+    {
+      depth++;
+    }
+    else if (c == '}' || c == ']')
+    {
+      if (--depth < 0)
+      {
+        return NULL;
+      }
+    }
+    else if (depth == 0)
+    {
+      // Top level scalar (number/true/false/null), runs to the next delimiter
+      if (!c || !strchr("-0123456789tfn", c))
+      {
+        return NULL;
+      }
+
+      while (p < end && *p && !strchr(",}] \t\r\n", *p))
+      {
+        p++;
+      }
+    }
+
+    if (depth == 0)
+    {
+      return p;
+    }
+  }
+
+  return NULL;
+}
+
+// Walks the top-level members of a JSON object payload, deserialising each one
+// and passing it (as a single member object) to the callback, so the working set
+// is bounded by the largest member rather than the whole payload. Every member is
+// fully parsed (and validated, if given a schema) even with a NULL callback, so a
+// check pass can guarantee a later pass never partially applies a bad payload. A
+// member failing the schema also sets _payloadRejected.
+boolean _streamJsonMembers(const char *payload, unsigned int length, jsonCallback callback, const schemaProgram_t *schema)
+{
+  const char *p = payload;
+  const char *end = payload + length;
+
+  p = _skipJsonWhitespace(p, end);
+  if (p >= end || *p++ != '{')
+  {
+    return false;
+  }
+
+  while (true)
+  {
+    p = _skipJsonWhitespace(p, end);
+    if (p >= end)
+    {
+      return false;
+    }
+
+    if (*p == '}')
+    {
+      return true;
+    }
+
+    // Member key
+    const char *key = p;
+    if (*p != '"' || !(p = _skipJsonValue(p, end)))
+    {
+      return false;
+    }
+
+    p = _skipJsonWhitespace(p, end);
+    if (p >= end || *p++ != ':')
+    {
+      return false;
+    }
+
+    // Member value
+    const char *value = _skipJsonWhitespace(p, end);
+    if (!(p = _skipJsonValue(value, end)))
+    {
+      return false;
+    }
+
+    JsonMemberReader reader(key, p);
+    JsonDocument json(&_jsonAllocator);
+    if (deserializeJson(json, reader))
+    {
+      return false;
+    }
+
+    if (schema && !_validateSchema(schema, json.as<JsonVariantConst>()))
+    {
+      _payloadRejected = true;
+      return false;
+    }
+
+    if (callback)
+    {
+      _streamingMembers = true;
+      callback(json.as<JsonVariant>());
+      _streamingMembers = false;
+    }
+
+    p = _skipJsonWhitespace(p, end);
+    if (p < end && *p == ',')
+    {
+      p++;
+    }
+    else if (p >= end || *p != '}')
+    {
+      return false;
+    }
+  }
+}
+
+/* Config delta helpers */
+configSnapshot_t *_findConfigSnapshot(uint32_t keyHash, const char *key)
+{
+  configSnapshot_t *empty = NULL;
+
+  for (uint8_t i = 0; i < MAX_CONFIG_SNAPSHOT_KEYS; i++)
+  {
+    configSnapshot_t *entry = &_configSnapshot[i];
+    if (!entry->key)
+    {
+      if (!empty)
+      {
+        empty = entry;
+      }
+    }
+    else if (entry->keyHash == keyHash && strcmp(entry->key, key) == 0)
+    {
+      return entry;
+    }
+  }
+
+  // Not found, so claim an empty slot (if any)
+  if (empty)
+  {
+    empty->keyHash = keyHash;
+    empty->valueHash = 0L;
+    empty->key = strdup(key);
+    empty->removed = false;
+  }
+
+  return empty;
+}
+
+// Config payloads can be partial, so keys missing from a payload are unchanged,
+// a key is only removed when it is explicitly set to null
+void _getConfigDelta(JsonVariant json, JsonObject delta)
+{
+  for (JsonPair kvp : json.as<JsonObject>())
+  {
+    const char *key = kvp.key().c_str();
+
+    FnvHashPrint valueHash;
+    serializeJson(kvp.value(), valueHash);
+
+    // Always pass on if we can't track this key
+    configSnapshot_t *entry = _findConfigSnapshot(oxrsKeyHash(key), key);
+    if (!entry || !entry->key)
+    {
+      delta[key] = kvp.value();
+      continue;
+    }
+
+    if (entry->valueHash != valueHash.hash)
+    {
+      entry->valueHash = valueHash.hash;
+      entry->removed = kvp.value().isNull();
+      delta[key] = kvp.value();
+    }
+  }
+}
+
+// Stops tracking removed keys, only once the delta callback is done with them
+void _releaseConfigSnapshots(void)
+{
+  for (uint8_t i = 0; i < MAX_CONFIG_SNAPSHOT_KEYS; i++)
+  {
+    configSnapshot_t *entry = &_configSnapshot[i];
+    if (entry->key && entry->removed)
+    {
+      free(entry->key);
+      entry->key = NULL;
+    }
+  }
+}
+
+/* Key handler helpers */
+boolean _addKeyHandler(keyHandler_t *handlers, const char *key, jsonCallback callback)
+{
+  uint32_t hash = oxrsKeyHash(key);
+
+  // Linear probe for an empty slot, or an existing handler for this key
+  for (uint8_t i = 0; i < MAX_KEY_HANDLERS; i++)
+  {
+    keyHandler_t *handler = &handlers[(hash + i) & (MAX_KEY_HANDLERS - 1)];
+    if (!handler->key || (handler->hash == hash && strcmp(handler->key, key) == 0))
+    {
+      handler->hash = hash;
+      handler->key = key;
+      handler->callback = callback;
+      return true;
+    }
+  }
+
+  // Table is full
+  return false;
+}
+
+keyHandler_t *_findKeyHandler(keyHandler_t *handlers, const char *key)
+{
+  uint32_t hash = oxrsKeyHash(key);
+
+  for (uint8_t i = 0; i < MAX_KEY_HANDLERS; i++)
+  {
+    keyHandler_t *handler = &handlers[(hash + i) & (MAX_KEY_HANDLERS - 1)];
+    if (!handler->key)
+    {
+      return NULL;
+    }
+
+    if (handler->hash == hash && strcmp(handler->key, key) == 0)
+    {
+      return handler;
+    }
+  }
+
+  return NULL;
+}
+
+void _dispatchKeys(keyHandler_t *handlers, JsonVariant json)
+{
+  // Single pass over the payload, each key is a hash lookup
+  for (JsonPair kvp : json.as<JsonObject>())
+  {
+    keyHandler_t *handler = _findKeyHandler(handlers, kvp.key().c_str());
+    if (handler && handler->callback)
+    {
+      handler->callback(kvp.value());
+    }
+  }
+}
+
+/* MQTT reconnect helpers */
+uint32_t _mqttJitter(void)
+{
+  // xorshift32, seeded from our MAC address so each device gets a different sequence
+  _mqttJitterState ^= _mqttJitterState << 13;
+  _mqttJitterState ^= _mqttJitterState >> 17;
+  _mqttJitterState ^= _mqttJitterState << 5;
+  return _mqttJitterState;
+}
+
+void _scheduleMqttReconnect(void)
+{
+  // Wait somewhere between half and all of the current backoff
+  _mqttReconnectWaitMs = (_mqttReconnectDelayMs / 2) + (_mqttJitter() % (_mqttReconnectDelayMs / 2 + 1));
+  _mqttReconnectLastMs = millis();
+
+  // Double the backoff for the next failure
+  _mqttReconnectDelayMs = min(_mqttReconnectDelayMs * 2, (uint32_t)MQTT_RECONNECT_MAX_MS);
+}
+
+boolean _isMqttReconnectDue(void)
+{
+  return (millis() - _mqttReconnectLastMs) >= _mqttReconnectWaitMs;
+}
+
+void _getMqttDisconnectsJson(JsonVariant json)
+{
+  static const char *reasons[MQTT_STATE_COUNT] = {
+      "connectionTimeout", "connectionLost", "connectFailed", "disconnected", NULL,
+      "badProtocol", "badClientId", "unavailable", "badCredentials", "unauthorised"};
+
+  JsonObject disconnects = json["mqttDisconnects"].to<JsonObject>();
+
+  for (uint8_t i = 0; i < MQTT_STATE_COUNT; i++)
+  {
+    if (reasons[i] && _mqttDisconnectCounts[i] > 0)
+    {
+      disconnects[reasons[i]] = _mqttDisconnectCounts[i];
+    }
+  }
+}
+
+/* Payload format helpers */
+const char *_getFormatName(payloadFormat_t format)
+{
+  return format == FORMAT_MSGPACK ? "msgpack" : "json";
+}
+
+payloadFormat_t _parseFormat(JsonVariant value)
+{
+  return strcmp(value | "json", "msgpack") == 0 ? FORMAT_MSGPACK : FORMAT_JSON;
+}
+
+boolean _publishMsgPack(const char *topic, JsonVariant json)
+{
+  if (!_mqtt.connected())
+  {
+    return false;
+  }
+
+  // Stream straight to the client, so we don't need a serialisation buffer
+  if (!_mqttClient.beginPublish(topic, measureMsgPack(json), false))
+  {
+    return false;
+  }
+
+  serializeMsgPack(json, _mqttClient);
+  return _mqttClient.endPublish();
+}
+
+/* File system helpers */
+void _invalidateFileSystemStats(void)
+{
+  _fileSystemStatsValid = false;
+}
+
+void _updateFileSystemStats(void)
+{
+  if (!_fileSystemStatsValid)
+  {
+    _fileSystemUsedBytes = LittleFS.usedBytes();
+    _fileSystemTotalBytes = LittleFS.totalBytes();
+    _fileSystemStatsValid = true;
+  }
+}
+
+#if defined(HEAP_PROFILING)
+/* Heap profiling helpers */
+void _sampleHeapFragmentation(void)
+{
+  if (_heapFragmentationSamples == HEAP_PROFILE_TREND_SIZE)
+  {
+    memmove(_heapFragmentationTrend, _heapFragmentationTrend + 1, HEAP_PROFILE_TREND_SIZE - 1);
+    _heapFragmentationSamples--;
+  }
+  _heapFragmentationTrend[_heapFragmentationSamples++] = _getHeapFragmentation();
+}
+
+void _getHeapProfileJson(JsonVariant json)
+{
+  JsonObject heapProfile = json["heapProfile"].to<JsonObject>();
+
+  for (uint8_t i = 0; i < HEAP_SITE_COUNT; i++)
+  {
+    JsonObject site = heapProfile[_heapSiteNames[i]].to<JsonObject>();
+    site["calls"] = _heapProfile[i].calls;
+    site["allocCount"] = _heapProfile[i].allocCount;
+    site["allocBytes"] = _heapProfile[i].allocBytes;
+    site["fragmentationDelta"] = _heapProfile[i].fragmentationDelta;
+  }
+
+  JsonArray trend = heapProfile["fragmentationTrend"].to<JsonArray>();
+  for (uint8_t i = 0; i < _heapFragmentationSamples; i++)
+  {
+    trend.add(_heapFragmentationTrend[i]);
+  }
+}
+#endif
+
+/* Log store helpers */
+void _flushLogStore(void)
+{
+  if (!_logStoreReady || _logBufferLength == 0)
+  {
+    return;
+  }
+
+  File file = LittleFS.open(LOG_FILE, "a");
+  if (!file)
+  {
+    return;
+  }
+
+  file.write(_logBuffer, _logBufferLength);
+  size_t size = file.size();
+  file.close();
+
+  _logBufferLength = 0;
+
+  // Rotate once the current log file is full
+  if (size >= LOG_FILE_MAX_BYTES)
+  {
+    LittleFS.remove(LOG_FILE_PREVIOUS);
+    LittleFS.rename(LOG_FILE, LOG_FILE_PREVIOUS);
+  }
+
+  _invalidateFileSystemStats();
+}
+
+size_t WT32Logger::write(uint8_t character)
+{
+  if (_logBufferLength == LOG_PAGE_BYTES)
+  {
+    _flushLogStore();
+  }
+
+  // Drop from the log store (but not the MQTT logger) if still full,
+  // i.e. the file system is not mounted yet
+  if (_logBufferLength < LOG_PAGE_BYTES)
+  {
+    if (_logBufferLength == 0)
+    {
+      _logBufferStart = millis();
+    }
+    _logBuffer[_logBufferLength++] = character;
+  }
+
+  return _mqttLogger.write(character);
+}
+
+void _logRecord(const char *format, int32_t arg = 0)
+{
+  if (_logRingCount == LOG_RING_SIZE)
+  {
+    _logRingHead = (_logRingHead + 1) % LOG_RING_SIZE;
+    _logRingCount--;
+    _logRingDropped++;
+  }
+
+  logRecord_t *record = &_logRing[(_logRingHead + _logRingCount) % LOG_RING_SIZE];
+  record->timestamp = millis();
+  record->format = format;
+  record->arg = arg;
+  _logRingCount++;
+}
+
+void _streamFile(Print &out, File &file)
+{
+  uint8_t buffer[FILE_STREAM_BYTES];
+  size_t length;
+  while ((length = file.read(buffer, sizeof(buffer))) > 0)
+  {
+    out.write(buffer, length);
+  }
+}
+
+void _streamFile(Print &out, const char *path)
+{
+  File file = LittleFS.open(path, "r");
+  if (!file)
+  {
+    return;
+  }
+
+  _streamFile(out, file);
+  file.close();
+}
+
+/* Telemetry spool helpers */
+uint32_t _getSpoolChecksum(const uint8_t *payload, size_t length)
+{
+  FnvHashPrint hash;
+  hash.write(payload, length);
+  return hash.hash;
+}
+
+void _flushTelemetrySpool(void)
+{
+  if (_spoolBufferLength == 0)
+  {
+    return;
+  }
+
+  File file = LittleFS.open(SPOOL_FILE, "a");
+  if (file)
+  {
+    _spoolFileBytes += file.write(_spoolBuffer, _spoolBufferLength);
+    file.close();
+  }
+
+  _spoolBufferLength = 0;
+  _invalidateFileSystemStats();
+}
+
+// Re-parses a document via its JSON text, turning any pre-formatted (serialized())
+// values, which MessagePack would copy verbatim, into plain ones
+boolean _parseRawJson(JsonVariantConst json, JsonDocument &parsed)
+{
+  size_t length = measureJson(json);
+  char *text = (char *)_psRamAllocator.allocate(length + 1);
+  if (!text)
+  {
+    return false;
+  }
+
+  serializeJson(json, text, length + 1);
+  DeserializationError error = deserializeJson(parsed, (const char *)text, length);
+  _psRamAllocator.deallocate(text);
+
+  return !error;
+}
+
+void _spoolTelemetry(JsonVariant json)
+{
+  // Ignore if disabled
+  if (_spoolMaxBytes == 0)
+  {
+    return;
+  }
+
+  // Records are MessagePack, whatever the telemetry format (only done offline)
+  JsonDocument parsed(&_psRamAllocator);
+  if (!_parseRawJson(json, parsed))
+  {
+    _spoolDropped++;
+    return;
+  }
+  json = parsed.as<JsonVariant>();
+
+  size_t length = measureMsgPack(json);
+  size_t recordLength = sizeof(spoolRecordHeader_t) + length;
+
+  // Spool is bounded, once full we drop new records rather than rewrite the file
+  if (length > SPOOL_MAX_RECORD_BYTES || (_spoolFileBytes + _spoolBufferLength + recordLength) > _spoolMaxBytes)
+  {
+    _spoolDropped++;
+    return;
+  }
+
+  if (_spoolBufferLength + recordLength > SPOOL_BUFFER_BYTES)
+  {
+    _flushTelemetrySpool();
+  }
+
+  if (_spoolBufferLength == 0)
+  {
+    _spoolBufferStart = millis();
+  }
+
+  uint8_t *payload = _spoolBuffer + _spoolBufferLength + sizeof(spoolRecordHeader_t);
+  serializeMsgPack(json, payload, length);
+
+  spoolRecordHeader_t header;
+  header.magic = SPOOL_RECORD_MAGIC;
+  header.length = length;
+  header.timestamp = millis();
+  header.checksum = _getSpoolChecksum(payload, length);
+  memcpy(_spoolBuffer + _spoolBufferLength, &header, sizeof(header));
+
+  _spoolBufferLength += recordLength;
+}
+
+// Reads the record at the current file position, returns false at the end of the
+// spool or if the record was only partially written (e.g. power lost mid write)
+boolean _readSpoolRecord(File &file, spoolRecordHeader_t *header, uint8_t *payload)
+{
+  if (file.read((uint8_t *)header, sizeof(spoolRecordHeader_t)) != sizeof(spoolRecordHeader_t))
+  {
+    return false;
+  }
+
+  if (header->magic != SPOOL_RECORD_MAGIC || header->length > SPOOL_MAX_RECORD_BYTES)
+  {
+    return false;
+  }
+
+  if (file.read(payload, header->length) != header->length)
+  {
+    return false;
+  }
+
+  return header->checksum == _getSpoolChecksum(payload, header->length);
+}
+
+void _resetTelemetrySpool(void)
+{
+  LittleFS.remove(SPOOL_FILE);
+  _invalidateFileSystemStats();
+
+  _spoolFileBytes = 0L;
+  _spoolReadOffset = 0L;
+  _spoolBootOffset = 0L;
+  _spoolRetries = 0;
+}
+
+// Returns the gzip compressed JSON, allocated from PSRAM (so the caller must
+// deallocate it), or NULL if it couldn't be compressed
+uint8_t *_gzipJson(JsonVariantConst json, size_t *compressed)
+{
+  size_t length = measureJson(json);
+  uint8_t *in = (uint8_t *)_psRamAllocator.allocate(length + 1);
+  uint8_t *out = (uint8_t *)_psRamAllocator.allocate(_gzipBound(length));
+
+  *compressed = 0;
+  if (in && out)
+  {
+    serializeJson(json, (char *)in, length + 1);
+    *compressed = _gzipCompress(in, length, out, &_psRamAllocator);
+  }
+  _psRamAllocator.deallocate(in);
+
+  if (*compressed == 0)
+  {
+    _psRamAllocator.deallocate(out);
+    return NULL;
+  }
+
+  return (uint8_t *)_psRamAllocator.reallocate(out, *compressed);
+}
+
+// Returns true if the cache holds the compressed JSON, only recompressing
+// if the content hash has changed since it was last compressed
+boolean _updateGzipCache(gzipCache_t *cache, JsonVariantConst json, uint32_t hash)
+{
+  if (cache->data && cache->hash == hash)
+  {
+    return true;
+  }
+
+  size_t compressed;
+  uint8_t *data = _gzipJson(json, &compressed);
+  if (!data)
+  {
+    return false;
+  }
+
+  _psRamAllocator.deallocate(cache->data);
+  cache->data = data;
+  cache->length = compressed;
+  cache->hash = hash;
+
+  return true;
+}
+
+/* Adoption info builders */
+void _getFirmwareJson(JsonVariant json)
+{
+  JsonObject firmware = json["firmware"].to<JsonObject>();
+
+  firmware["name"] = FW_NAME;
+  firmware["shortName"] = FW_SHORT_NAME;
+  firmware["maker"] = FW_MAKER;
+  firmware["version"] = _fwVersion;
+#if defined(FW_HARDWARE)
+  firmware["hardware"] = STRINGIFY(FW_HARDWARE);
+#endif
+#if defined(FW_GITHUB_URL)
+  firmware["githubUrl"] = FW_GITHUB_URL;
+#endif
+}
+
+void _getSystemJson(JsonVariant json)
+{
+  JsonObject system = json["system"].to<JsonObject>();
+
+  system["heapUsedBytes"] = ESP.getHeapSize();
+  system["heapFreeBytes"] = ESP.getFreeHeap();
+  system["heapMaxAllocBytes"] = ESP.getMaxAllocHeap();
+  system["flashChipSizeBytes"] = ESP.getFlashChipSize();
+
+  system["sketchSpaceUsedBytes"] = ESP.getSketchSize();
+  system["sketchSpaceTotalBytes"] = ESP.getFreeSketchSpace();
+
+  _updateFileSystemStats();
+  system["fileSystemUsedBytes"] = _fileSystemUsedBytes;
+  system["fileSystemTotalBytes"] = _fileSystemTotalBytes;
+
+  system["availablePsRamBytes"] = ESP.getPsramSize();
+  system["freePsRamBytes"] = ESP.getFreePsram();
+}
+
+void _getNetworkJson(JsonVariant json)
+{
+  JsonObject network = json["network"].to<JsonObject>();
+
+  byte mac[6];
+
+#if defined(ETH_MODE)
+  Ethernet.MACAddress(mac);
+
+  network["mode"] = "ethernet";
+  network["ip"] = Ethernet.localIP();
+#else
+  WiFi.macAddress(mac);
+
+  network["mode"] = "wifi";
+  network["ip"] = WiFi.localIP();
+#endif
+
+  char mac_display[18];
+  _formatMACAddress(mac_display, mac);
+  network["mac"] = mac_display;
+}
+
+void _getPayloadFormatJson(JsonVariant json)
+{
+  JsonObject payloadFormat = json["payloadFormat"].to<JsonObject>();
+
+  payloadFormat["status"] = _getFormatName(_statusFormat);
+  payloadFormat["telemetry"] = _getFormatName(_telemetryFormat);
+}
+
+void _getFormatSchemaJson(JsonObject properties, const char *key, const char *title)
+{
+  JsonObject format = properties[key].to<JsonObject>();
+  format["title"] = title;
+  format["description"] = "Encoding for published payloads, either JSON text or the more compact binary MessagePack (defaults to json).";
+  format["type"] = "string";
+
+  JsonArray formatEnum = format["enum"].to<JsonArray>();
+  formatEnum.add("json");
+  formatEnum.add("msgpack");
+}
+
+void _getConfigSchemaJson(JsonVariant json)
+{
+  JsonObject configSchema = json["configSchema"].to<JsonObject>();
+
+  // Config schema metadata
+  configSchema["$schema"] = JSON_SCHEMA_VERSION;
+  configSchema["title"] = FW_SHORT_NAME;
+  configSchema["type"] = "object";
+
+  JsonObject properties = configSchema["properties"].to<JsonObject>();
+
+  // Firmware config schema (if any)
+  if (!_fwConfigSchema.isNull())
+  {
+    _mergeJson(properties, _fwConfigSchema.as<JsonVariant>());
+  }
+
+  // sensor config only if ESP is S3 or SHT20 found
+#if defined(CONFIG_IDF_TARGET_ESP32S3)
+  bool _s3Detected = true;
+#else
+  bool _s3Detected = false;
+#endif
+
+  if (_s3Detected || _sht20Found)
+  {
+    JsonObject climateUpdateSeconds = properties["climateUpdateSeconds"].to<JsonObject>();
+    climateUpdateSeconds["title"] = "Sensor Update Interval (seconds)";
+    climateUpdateSeconds["description"] = "How often to read and report the value from connected sensors (ESP32 internal temperature, SHT20) (defaults to 60 seconds, setting to 0 disables climate reports). Must be a number between 0 and 86400 (i.e. 1 day).";
+    climateUpdateSeconds["type"] = "integer";
+    climateUpdateSeconds["minimum"] = 0;
+    climateUpdateSeconds["maximum"] = 86400;
+  }
+
+  JsonObject systemUpdateSeconds = properties["systemUpdateSeconds"].to<JsonObject>();
+  systemUpdateSeconds["title"] = "System Health Update Interval (seconds)";
+  systemUpdateSeconds["description"] = "How often to check heap, PSRAM and file system usage and report any values which have changed significantly since last reported (defaults to 0, which disables system health reports). Must be a number between 0 and 86400 (i.e. 1 day).";
+  systemUpdateSeconds["type"] = "integer";
+  systemUpdateSeconds["minimum"] = 0;
+  systemUpdateSeconds["maximum"] = 86400;
+
+  // Payload encodings
+  _getFormatSchemaJson(properties, "statusFormat", "Status Payload Format");
+  _getFormatSchemaJson(properties, "telemetryFormat", "Telemetry Payload Format");
+}
+
+void _getCommandSchemaJson(JsonVariant json)
+{
+  JsonObject commandSchema = json["commandSchema"].to<JsonObject>();
+  // Command schema metadata
+  commandSchema["$schema"] = JSON_SCHEMA_VERSION;
+  commandSchema["title"] = FW_SHORT_NAME;
+  commandSchema["type"] = "object";
+
+  JsonObject properties = commandSchema["properties"].to<JsonObject>();
+
+  // Firmware command schema (if any)
+  if (!_fwCommandSchema.isNull())
+  {
+    _mergeJson(properties, _fwCommandSchema.as<JsonVariant>());
+  }
+
+  // Republish adoption command
+  JsonObject adopt = properties["adopt"].to<JsonObject>();
+  adopt["title"] = "Republish Adoption";
+  adopt["type"] = "boolean";
+
+  // Restart command
+  JsonObject restart = properties["restart"].to<JsonObject>();
+  restart["title"] = "Restart";
+  restart["type"] = "boolean";
+}
+
+void _compileSchemas(void)
+{
+  JsonDocument json(&_psRamAllocator);
+
+  _getConfigSchemaJson(json.as<JsonVariant>());
+  _compileSchema(&_configSchemaProgram, json["configSchema"], &_psRamAllocator);
+  _configSchemaHash = _getValueHash(json["configSchema"]);
+
+  _getCommandSchemaJson(json.as<JsonVariant>());
+  _compileSchema(&_commandSchemaProgram, json["commandSchema"], &_psRamAllocator);
+  _commandSchemaHash = _getValueHash(json["commandSchema"]);
+
+  _schemaProgramsDirty = false;
+}
+
+void _getSchemaHashJson(JsonVariant json)
+{
+  if (_schemaProgramsDirty)
+  {
+    _compileSchemas();
+  }
+
+  char hashTxt[9];
+  sprintf_P(hashTxt, PSTR("%08" PRIx32), _configSchemaHash);
+  json["configSchemaHash"] = hashTxt;
+  sprintf_P(hashTxt, PSTR("%08" PRIx32), _commandSchemaHash);
+  json["commandSchemaHash"] = hashTxt;
+}
+
+/* API callbacks */
+void _apiAdopt(JsonVariant json)
+{
+  HEAP_PROFILE(HEAP_SITE_ADOPT);
+
+  // Build device adoption info
+  _getFirmwareJson(json);
+  _getSystemJson(json);
+  _getNetworkJson(json);
+  _getPayloadFormatJson(json);
+
+  // Full schemas can be fetched separately if the hashes have changed
+  if (_adoptSchemaHashes)
+  {
+    _getSchemaHashJson(json);
+  }
+  else
+  {
+    _getConfigSchemaJson(json);
+    _getCommandSchemaJson(json);
+  }
+}
+
+void _sendSchema(Response &res, JsonVariantConst schema, gzipCache_t *cache, uint32_t hash)
+{
+  char etag[11];
+  sprintf_P(etag, PSTR("\"%08" PRIx32 "\""), hash);
+
+  res.set("Content-Type", "application/json");
+  res.set("ETag", etag);
+
+  if (_payloadCompression)
+  {
+    res.set("Vary", "Accept-Encoding");
+  }
+
+  if (_payloadCompression && _requestAcceptsGzip && _updateGzipCache(cache, schema, hash))
+  {
+    res.set("Content-Encoding", "gzip");
+    res.write(cache->data, cache->length);
+  }
+  else
+  {
+    serializeJson(schema, res);
+  }
+}
+
+void _apiGetConfigSchema(Request &req, Response &res)
+{
+  if (_schemaProgramsDirty)
+  {
+    _compileSchemas();
+  }
+
+  JsonDocument json(&_psRamAllocator);
+  _getConfigSchemaJson(json.as<JsonVariant>());
+  _sendSchema(res, json["configSchema"], &_configSchemaGzip, _configSchemaHash);
+}
+
+void _apiGetCommandSchema(Request &req, Response &res)
+{
+  if (_schemaProgramsDirty)
+  {
+    _compileSchemas();
+  }
+
+  JsonDocument json(&_psRamAllocator);
+  _getCommandSchemaJson(json.as<JsonVariant>());
+  _sendSchema(res, json["commandSchema"], &_commandSchemaGzip, _commandSchemaHash);
+}
+
+/* Adoption helpers */
+uint32_t _getAdoptHash(JsonVariant json, const char *topic)
+{
+  FnvHashPrint hash;
+  hash.print(topic);
+
+  for (JsonPair kvp : json.as<JsonObject>())
+  {
+    // System stats change constantly so aren't considered part of the content
+    if (strcmp(kvp.key().c_str(), "system") == 0)
+    {
+      continue;
+    }
+
+    hash.print(kvp.key().c_str());
+    serializeJson(kvp.value(), hash);
+  }
+
+  return hash.hash;
+}
+
+uint32_t _readAdoptHash(void)
+{
+  uint32_t hash = 0;
+
+  File file = LittleFS.open(ADOPT_HASH_FILE, "r");
+  if (file)
+  {
+    file.read((uint8_t *)&hash, sizeof(hash));
+    file.close();
+  }
+
+  return hash;
+}
+
+void _writeAdoptHash(uint32_t hash)
+{
+  File file = LittleFS.open(ADOPT_HASH_FILE, "w");
+  if (file)
+  {
+    file.write((uint8_t *)&hash, sizeof(hash));
+    file.close();
+  }
+
+  _invalidateFileSystemStats();
+}
+
+// Compressed afresh each time, as adoption info is only published when its
+// content changes and always carries the latest system stats
+boolean _publishGzipAdopt(const char *topic, JsonVariant json)
+{
+  if (!_mqtt.connected())
+  {
+    return false;
+  }
+
+  size_t compressed;
+  uint8_t *data = _gzipJson(json, &compressed);
+  if (!data)
+  {
+    return false;
+  }
+
+  // Stream straight to the client, so we aren't limited by its buffer size
+  boolean success = _mqttClient.beginPublish(topic, compressed, true);
+  if (success)
+  {
+    _mqttClient.write(data, compressed);
+    success = _mqttClient.endPublish();
+  }
+
+  _psRamAllocator.deallocate(data);
+  return success;
+}
+
+void _publishAdopt(boolean force)
+{
+  JsonDocument json(&_psRamAllocator);
+  JsonVariant adopt = _api.getAdopt(json.as<JsonVariant>());
+
+  char topic[64];
+  uint32_t hash = _getAdoptHash(adopt, _mqtt.getAdoptTopic(topic));
+
+  char hashTxt[9];
+  sprintf_P(hashTxt, PSTR("%08" PRIx32), hash);
+
+  // Adoption info is retained, so only republish if the content has changed
+  // since we last published it, otherwise just send a heartbeat with the hash
+  // (as telemetry, published from loop() in the selected telemetry format)
+  if (force || hash != _readAdoptHash())
+  {
+    adopt["adoptHash"] = hashTxt;
+
+    boolean success = _payloadCompression ? _publishGzipAdopt(topic, adopt) : _mqtt.publishAdopt(adopt);
+    if (success)
+    {
+      _writeAdoptHash(hash);
+    }
+  }
+  else
+  {
+    _pendingTelemetry["adoptHash"] = hashTxt;
+  }
+}
+
+void _apiGetLogs(Request &req, Response &res)
+{
+  // Include everything logged so far
+  _flushLogStore();
+
+  res.set("Content-Type", "text/plain");
+  _streamFile(res, LOG_FILE_PREVIOUS);
+  _streamFile(res, LOG_FILE);
+}
+
+/* OTA helpers */
+// Flashing arbitrary firmware via REST is opt-in
+boolean _otaEnabled = false;
+boolean _otaRestartPending = false;
+
+void _apiPostOta(Request &req, Response &res)
+{
+  // Restart into the new firmware once this response has been sent
+  _otaRestartPending = _otaUpdate(req, res, _logger);
+}
+
+/* REST request helpers */
+uint32_t _getAdoptEtag(void)
+{
+  // Schemas are versioned by their hashes, everything else by our counter,
+  // live system stats (heap etc) are not considered a change
+  if (_schemaProgramsDirty)
+  {
+    _compileSchemas();
+  }
+
+  FnvHashPrint hash;
+  hash.write((const uint8_t *)&_adoptEtagSalt, sizeof(_adoptEtagSalt));
+  hash.write((const uint8_t *)&_adoptVersion, sizeof(_adoptVersion));
+  hash.write((const uint8_t *)&_configSchemaHash, sizeof(_configSchemaHash));
+  hash.write((const uint8_t *)&_commandSchemaHash, sizeof(_commandSchemaHash));
+  return hash.hash;
+}
+
+// Returns the ETag for the requested resource, or 0 if not conditional
+uint32_t _getRequestEtag(const char *head)
+{
+  if (_isRequestFor(head, "/adopt"))
+  {
+    return _getAdoptEtag();
+  }
+
+  if (_isRequestFor(head, "/configSchema") || _isRequestFor(head, "/commandSchema"))
+  {
+    if (_schemaProgramsDirty)
+    {
+      _compileSchemas();
+    }
+    return _isRequestFor(head, "/configSchema") ? _configSchemaHash : _commandSchemaHash;
+  }
+
+  return 0L;
+}
+
+void _sendResponseHead(Print &out, const __FlashStringHelper *status, const char *etag)
+{
+  out.print(F("HTTP/1.1 "));
+  out.print(status);
+  out.print(F("\r\nETag: "));
+  out.print(etag);
+  out.print(F("\r\nCache-Control: no-cache\r\nConnection: close\r\n" REST_CORS_HEADERS));
+}
+
+// Returns true if we answered the request, otherwise it is left for the API
+boolean _serveRequest(Client &client, const char *head)
+{
+  uint32_t hash = _getRequestEtag(head);
+  if (hash == 0L)
+  {
+    return false;
+  }
+
+  char etag[11];
+  sprintf_P(etag, PSTR("\"%08" PRIx32 "\""), hash);
+
+  // Dashboards polling every device get a 304 without any JSON being built
+  if (_isNotModified(head, etag))
+  {
+    BufferedPrint out(client);
+    _sendResponseHead(out, F("304 Not Modified"), etag);
+    out.print(F("\r\n"));
+    return true;
+  }
+
+  // Adoption info is served by the API, but that can't send an ETag
+  if (!_isRequestFor(head, "/adopt"))
+  {
+    return false;
+  }
+
+  JsonDocument json(&_psRamAllocator);
+  JsonVariant adopt = _api.getAdopt(json.as<JsonVariant>());
+
+  BufferedPrint out(client);
+  _sendResponseHead(out, F("200 OK"), etag);
+  out.print(F("Content-Type: application/json\r\nContent-Length: "));
+  out.print(measureJson(adopt));
+  out.print(F("\r\n\r\n"));
+  serializeJson(adopt, out);
+  return true;
+}
+
+// Returns true if we answered the request, otherwise it is left for the API
+boolean _serveStaticAsset(Client &client, const char *head)
+{
+  if (!_staticPath || strncmp_P(head, PSTR("GET "), 4) != 0)
+  {
+    return false;
+  }
+
+  // Match our path prefix (ignoring any query)
+  const char *uri = &head[4];
+  size_t uriLength = strcspn(uri, " ?\r\n");
+  size_t prefixLength = strlen(_staticPath);
+
+  if (uriLength < prefixLength || strncmp(uri, _staticPath, prefixLength) != 0)
+  {
+    return false;
+  }
+
+  const char *name = uri + prefixLength;
+  size_t nameLength = uriLength - prefixLength;
+  if (nameLength > 0 && name[0] != '/')
+  {
+    return false;
+  }
+
+  // Map to a file, leaving room for the ".gz" suffix
+  char path[STATIC_ASSET_PATH_BYTES];
+  const char *index = "";
+  if (nameLength == 0)
+  {
+    index = "/index.html";
+  }
+  else if (name[nameLength - 1] == '/')
+  {
+    index = "index.html";
+  }
+  int length = snprintf(path, sizeof(path) - 3, "%s%.*s%s", _staticDirectory, (int)nameLength, name, index);
+  if (length < 0 || length >= (int)sizeof(path) - 3 || strstr(path, ".."))
+  {
+    return false;
+  }
+
+  const char *contentType = _getContentType(path);
+
+  // Prefer a pre-gzipped copy if the client can accept it
+  size_t acceptLength;
+  const char *accept = _findRequestHeader(head, "Accept-Encoding", &acceptLength);
+  boolean gzipped = false;
+
+  File file;
+  if (accept && _valueContains(accept, acceptLength, "gzip"))
+  {
+    strcat(path, ".gz");
+    file = LittleFS.open(path, "r");
+    gzipped = file && !file.isDirectory();
+    path[length] = '\0';
+  }
+
+  if (!gzipped)
+  {
+    file = LittleFS.open(path, "r");
+    if (!file || file.isDirectory())
+    {
+      return false;
+    }
+  }
+
+  client.print(F("HTTP/1.1 200 OK\r\nContent-Type: "));
+  client.print(contentType);
+  if (gzipped)
+  {
+    client.print(F("\r\nContent-Encoding: gzip\r\nVary: Accept-Encoding"));
+  }
+
+  // Pages must be revalidated (so UI updates are picked up), everything else
+  // they reference can be cached for as long as the page keeps referencing it
+  if (strcmp(contentType, "text/html") == 0)
+  {
+    client.print(F("\r\nCache-Control: no-cache"));
+  }
+  else
+  {
+    client.print(F("\r\nCache-Control: public, max-age=" STATIC_ASSET_MAX_AGE));
+  }
+
+  client.print(F("\r\nContent-Length: "));
+  client.print(file.size());
+  client.print(F("\r\nConnection: close\r\n\r\n"));
+
+  _streamFile(client, file);
+  file.close();
+  return true;
+}
+
+void _handleRestClient(Client &client)
+{
+  char head[REST_REQUEST_HEAD_BYTES];
+  size_t length = _readRequestHead(client, head, sizeof(head));
+
+  // Anything but a GET can save/delete config files
+  if (strncmp_P(head, PSTR("GET "), 4) != 0)
+  {
+    _invalidateFileSystemStats();
+  }
+
+  if (_serveRequest(client, head) || _serveStaticAsset(client, head))
+  {
+    client.stop();
+    return;
+  }
+
+  // Our API handlers can't see request headers, so note what they need
+  size_t acceptLength;
+  const char *accept = _findRequestHeader(head, "Accept-Encoding", &acceptLength);
+  _requestAcceptsGzip = accept && _valueContains(accept, acceptLength, "gzip");
+
+  PeekedClient peeked(client, (const uint8_t *)head, length);
+  _api.loop(&peeked);
+}
+
+/* Config cache helpers */
+void _mergeConfigCache(JsonVariant json)
+{
+  // Same as the config deltas, missing keys are unchanged and null removes a key
+  for (JsonPair kvp : json.as<JsonObject>())
+  {
+    if (kvp.value().isNull())
+    {
+      _configCache.remove(kvp.key());
+    }
+    else
+    {
+      _configCache[kvp.key()] = kvp.value();
+    }
+  }
+}
+
+void _cacheConfig(void)
+{
+  FnvHashPrint hash;
+  serializeJson(_configCache, hash);
+
+  // Nothing to do if this is the config we already have cached
+  if (hash.hash == _configCacheHash)
+  {
+    return;
+  }
+
+  File file = LittleFS.open(CONFIG_CACHE_FILE, "w");
+  if (file)
+  {
+    file.write((uint8_t *)&hash.hash, sizeof(hash.hash));
+    serializeJson(_configCache, file);
+    file.close();
+
+    _configCacheHash = hash.hash;
+  }
+
+  _invalidateFileSystemStats();
+}
+
+/* MQTT callbacks */
+void _mqttConnected()
+{
+  // MqttLogger doesn't copy the logging topic to an internal
+  // buffer so we have to use a static array here
+  static char logTopic[64];
+  _mqttLogger.setTopic(_mqtt.getLogTopic(logTopic));
+
+  // Publish device adoption info (if changed)
+  _publishAdopt(false);
+
+  // Log the fact we are now connected
+  _logger.println("[wt32] mqtt connected");
+
+  // Status screen MQTT topic needs updating
+  _statusTxtDirty = true;
+
+  // Reset our reconnect backoff
+  _mqttReconnectDelayMs = MQTT_RECONNECT_MIN_MS;
+
+  // Let any subscribers (e.g. the UI) know we are connected
+  _lastMqttEventState = MQTT_CONNECTED;
+  _queueEvent(EVENT_MQTT_CONNECTED, 0);
+
+  // Report any disconnects we have seen since boot
+  _getMqttDisconnectsJson(_pendingTelemetry.as<JsonVariant>());
+  if (_pendingTelemetry["mqttDisconnects"].size() == 0)
+  {
+    _pendingTelemetry.remove("mqttDisconnects");
+  }
+
+  // Report our boot timeline (up to this first connection) once
+  if (!_bootTimelinePublished)
+  {
+    _bootTimelinePublished = true;
+    _markBootStep("mqttConnected");
+
+    _getBootTimelineJson(_pendingTelemetry.as<JsonVariant>());
+  }
+}
+
+void _mqttDisconnected(int state)
+{
+  // Count the disconnect reason and back off before trying again
+  if (state >= MQTT_CONNECTION_TIMEOUT && state <= MQTT_CONNECT_UNAUTHORIZED)
+  {
+    _mqttDisconnectCounts[state - MQTT_CONNECTION_TIMEOUT]++;
+  }
+  _scheduleMqttReconnect();
+
+  // Status screen MQTT topic needs updating
+  _statusTxtDirty = true;
+
+  // Only raise an event on a transition, not every failed reconnect attempt
+  if (state != _lastMqttEventState)
+  {
+    _lastMqttEventState = state;
+    _queueEvent(EVENT_MQTT_DISCONNECTED, state);
+  }
+
+  // Log the disconnect reason
+  // See https://github.com/knolleary/pubsubclient/blob/2d228f2f862a95846c65a8518c79f48dfc8f188c/src/PubSubClient.h#L44
+  switch (state)
+  {
+  case MQTT_CONNECTION_TIMEOUT:
+    _logRecord("[wt32] mqtt connection timeout");
+    break;
+  case MQTT_CONNECTION_LOST:
+    _logRecord("[wt32] mqtt connection lost");
+    break;
+  case MQTT_CONNECT_FAILED:
+    _logRecord("[wt32] mqtt connect failed");
+    break;
+  case MQTT_DISCONNECTED:
+    _logRecord("[wt32] mqtt disconnected");
+    break;
+  case MQTT_CONNECT_BAD_PROTOCOL:
+    _logRecord("[wt32] mqtt bad protocol");
+    break;
+  case MQTT_CONNECT_BAD_CLIENT_ID:
+    _logRecord("[wt32] mqtt bad client id");
+    break;
+  case MQTT_CONNECT_UNAVAILABLE:
+    _logRecord("[wt32] mqtt unavailable");
+    break;
+  case MQTT_CONNECT_BAD_CREDENTIALS:
+    _logRecord("[wt32] mqtt bad credentials");
+    break;
+  case MQTT_CONNECT_UNAUTHORIZED:
+    _logRecord("[wt32] mqtt unauthorised");
+    break;
+  }
+}
+
+void _configClimateUpdateSeconds(JsonVariant value)
+{
+  // SHT20 sensor config
+  _climateUpdateMs = value.as<uint32_t>() * 1000L;
+  if (_climateUpdateMs == 0)
+  {
+    _temperature = CLIMATE_INVALID;
+    _humidity = CLIMATE_INVALID;
+    if (_onClimateUpdate)
+    {
+      _onClimateUpdate();
+    }
+  }
+}
+
+void _configSystemUpdateSeconds(JsonVariant value)
+{
+  _systemUpdateMs = value.as<uint32_t>() * 1000L;
+
+  // Report everything on the next update
+  _lastSystemJson.clear();
+}
+
+void _configStatusFormat(JsonVariant value)
+{
+  _statusFormat = _parseFormat(value);
+  _adoptVersion++;
+}
+
+void _configTelemetryFormat(JsonVariant value)
+{
+  _telemetryFormat = _parseFormat(value);
+  _adoptVersion++;
+}
+
+void _commandAdopt(JsonVariant value)
+{
+  // Force a republish, e.g. if the broker has lost its retained messages
+  if (value.as<bool>())
+  {
+    _publishAdopt(true);
+  }
+}
+
+void _commandRestart(JsonVariant value)
+{
+  // Core restart command
+  if (value.as<bool>())
+  {
+    ESP.restart();
+  }
+}
+
+void _mqttConfig(JsonVariant json)
+{
+  // Reject anything which doesn't match our config schema (streamed members
+  // were validated before any of them were applied)
+  if (_schemaProgramsDirty)
+  {
+    _compileSchemas();
+  }
+
+  if (!_streamingMembers && !_validateSchema(&_configSchemaProgram, json))
+  {
+    _logRecord("[wt32] config failed schema validation");
+    _payloadRejected = true;
+    return;
+  }
+
+  // Streamed payloads raise a single event once every member is applied
+  if (!_streamingMembers)
+  {
+    _queueEvent(EVENT_CONFIG_RECEIVED, 0);
+  }
+
+  // Keep everything applied so far, to persist once the payload is done
+  _mergeConfigCache(json);
+
+  // Dispatch to any core/firmware key handlers
+  _dispatchKeys(_configKeyHandlers, json);
+
+  // Pass on to the firmware callback
+  if (_onConfig)
+  {
+    _onConfig(json);
+  }
+
+  // Pass on only what has changed to the firmware delta callback
+  if (_onConfigDelta)
+  {
+    JsonDocument delta(&_jsonAllocator);
+    _getConfigDelta(json, delta.to<JsonObject>());
+
+    if (delta.size() > 0)
+    {
+      _onConfigDelta(delta.as<JsonVariant>());
+    }
+
+    _releaseConfigSnapshots();
+  }
+}
+
+void _mqttCommand(JsonVariant json)
+{
+  // Reject anything which doesn't match our command schema (streamed members
+  // were validated before any of them were applied)
+  if (_schemaProgramsDirty)
+  {
+    _compileSchemas();
+  }
+
+  if (!_streamingMembers && !_validateSchema(&_commandSchemaProgram, json))
+  {
+    _logRecord("[wt32] command failed schema validation");
+    _payloadRejected = true;
+    return;
+  }
+
+  // Dispatch to any core/firmware key handlers
+  _dispatchKeys(_commandKeyHandlers, json);
+
+  // Pass on to the firmware callback
+  if (_onCommand)
+  {
+    _onCommand(json);
+  }
+}
+
+int _streamReceive(const char *payload, unsigned int length, jsonCallback callback)
+{
+  if (_schemaProgramsDirty)
+  {
+    _compileSchemas();
+  }
+
+  boolean config = callback == _mqttConfig;
+  const schemaProgram_t *schema = config ? &_configSchemaProgram : &_commandSchemaProgram;
+
+  // Parse and validate every member first so we never partially apply a bad
+  // payload, then apply them (the members are not validated again)
+  _payloadRejected = false;
+  if (!_streamJsonMembers(payload, length, NULL, schema))
+  {
+    // Report it the same as the whole document would have been
+    if (!_payloadRejected)
+    {
+      return MQTT_RECEIVE_JSON_ERROR;
+    }
+
+    _logRecord(config ? "[wt32] config failed schema validation" : "[wt32] command failed schema validation");
+    return MQTT_RECEIVE_OK;
+  }
+
+  if (!_streamJsonMembers(payload, length, callback, NULL))
+  {
+    return MQTT_RECEIVE_JSON_ERROR;
+  }
+
+  if (config)
+  {
+    _queueEvent(EVENT_CONFIG_RECEIVED, 0);
+  }
+
+  return MQTT_RECEIVE_OK;
+}
+
+int _mqttStreamReceive(char *topic, byte *payload, unsigned int length)
+{
+  char topicBuf[64];
+
+  if (strcmp(topic, _mqtt.getConfigTopic(topicBuf)) == 0)
+  {
+    return _streamReceive((const char *)payload, length, _mqttConfig);
+  }
+
+  if (strcmp(topic, _mqtt.getCommandTopic(topicBuf)) == 0)
+  {
+    return _streamReceive((const char *)payload, length, _mqttCommand);
+  }
+
+  return _mqtt.receive(topic, payload, length);
+}
+
+void _mqttCallback(char *topic, byte *payload, int length)
+{
+  HEAP_PROFILE(HEAP_SITE_MQTT_RECEIVE);
+
+  // Pass down to our MQTT handler and check it was processed ok, large
+  // payloads can be parsed one key at a time to avoid a full document copy
+  _payloadRejected = false;
+  int state = _mqttStreaming && length > MQTT_STREAMING_THRESHOLD_BYTES
+                  ? _mqttStreamReceive(topic, payload, length)
+                  : _mqtt.receive(topic, payload, length);
+
+  // Cache successfully applied config for replay on boot (never one that
+  // was rejected, which would replace the last good config)
+  char configTopic[64];
+  if (state == MQTT_RECEIVE_OK && !_payloadRejected && strcmp(topic, _mqtt.getConfigTopic(configTopic)) == 0)
+  {
+    _cacheConfig();
+  }
+
+  switch (state)
   {
   case MQTT_RECEIVE_ZERO_LENGTH:
-    _logger.println(F("[wt32] empty mqtt payload received"));
+    _logRecord("[wt32] empty mqtt payload received");
     break;
   case MQTT_RECEIVE_JSON_ERROR:
-    _logger.println(F("[wt32] failed to deserialise mqtt json payload"));
+    _logRecord("[wt32] failed to deserialise mqtt json payload");
     break;
   case MQTT_RECEIVE_NO_CONFIG_HANDLER:
-    _logger.println(F("[wt32] no mqtt config handler"));
+    _logRecord("[wt32] no mqtt config handler");
     break;
   case MQTT_RECEIVE_NO_COMMAND_HANDLER:
-    _logger.println(F("[wt32] no mqtt command handler"));
+    _logRecord("[wt32] no mqtt command handler");
     break;
   }
 }
@@ -350,119 +2216,496 @@ void OXRS_WT32::setMqttAuth(const char *username, const char *password)
   _mqtt.setAuth(username, password);
 }
 
-void OXRS_WT32::setMqttTopicPrefix(const char *prefix)
+void OXRS_WT32::setMqttTopicPrefix(const char *prefix)
+{
+  _mqtt.setTopicPrefix(prefix);
+}
+
+void OXRS_WT32::setMqttTopicSuffix(const char *suffix)
+{
+  _mqtt.setTopicSuffix(suffix);
+}
+
+boolean OXRS_WT32::setMqttBufferSize(uint16_t size)
+{
+  return _mqttClient.setBufferSize(size);
+}
+
+void OXRS_WT32::enableOta(void)
+{
+  _otaEnabled = true;
+}
+
+void OXRS_WT32::setMqttStreaming(boolean enabled)
+{
+  _mqttStreaming = enabled;
+}
+
+void OXRS_WT32::begin(jsonCallback config, jsonCallback command, climateUpdateCallback climateUpdate)
+{
+  // Everything from here is timestamped for our boot timeline
+  _markBootStep("begin");
+
+  // Mount the file system early so boot logging can be persisted (the
+  // REST API mounts it again, formatting if needed, during initialisation)
+  _logStoreReady = LittleFS.begin();
+  _markBootStep("fileSystem");
+
+  // Get our firmware details
+  JsonDocument json(&_jsonAllocator);
+  _getFirmwareJson(json.as<JsonVariant>());
+
+  // Log firmware details
+  _logger.print(F("[wt32] "));
+  serializeJson(json, _logger);
+  _logger.println();
+  _markBootStep("firmware");
+
+  // We wrap the callbacks so we can intercept messages intended for the WT32
+  _onConfig = config;
+  _onCommand = command;
+
+  // upstream callback
+  _onClimateUpdate = climateUpdate;
+
+  // Adoption ETags must not survive a restart
+  _adoptEtagSalt = esp_random();
+
+  // Register our key handlers and apply any cached config, so the UI
+  // is correct before the network is up and retained config arrives
+  _initialiseConfig();
+  _markBootStep("config");
+
+  // Set up network and obtain an IP address
+  byte mac[6];
+  _initialiseNetwork(mac);
+  _markBootStep("network");
+
+  // Set up MQTT (don't attempt to connect yet)
+  _initialiseMqtt(mac);
+  _markBootStep("mqtt");
+
+  // Set up the REST API
+  _initialiseRestApi();
+  _markBootStep("restApi");
+
+  // Set up the climate sensor(s)
+  _initialiseClimateSensor();
+  _markBootStep("climateSensor");
+
+  // Recover any telemetry spooled before we restarted
+  _initialiseTelemetrySpool();
+  _markBootStep("telemetrySpool");
+
+  // Sensor detection affects our config schema
+  _schemaProgramsDirty = true;
+
+  _logBootTimeline();
+}
+
+void OXRS_WT32::loop(void)
+{
+  // Check our network connection, noting any change for the status screen
+  boolean networkConnected = _isNetworkConnected();
+  if (networkConnected != _lastNetworkConnected)
+  {
+    _lastNetworkConnected = networkConnected;
+    _statusTxtDirty = true;
+
+    _queueEvent(networkConnected ? EVENT_LINK_UP : EVENT_LINK_DOWN, 0);
+#if !defined(ETH_MODE)
+    // WiFi (re)connects always (re)acquire an IP address
+    if (networkConnected)
+    {
+      _queueEvent(EVENT_IP_ACQUIRED, 0);
+      _adoptVersion++;
+    }
+#endif
+  }
+
+  if (networkConnected)
+  {
+    // Maintain our DHCP lease (2 = renewed, 4 = rebound, either may change our IP)
+#if defined(ETH_MODE)
+    int dhcpState = Ethernet.maintain();
+    if (dhcpState == 2 || dhcpState == 4)
+    {
+      _statusTxtDirty = true;
+      _queueEvent(EVENT_IP_ACQUIRED, 0);
+      _adoptVersion++;
+    }
+#endif
+
+    // Handle any MQTT messages, reconnect attempts are paced by our backoff
+    if (_mqtt.connected() || _isMqttReconnectDue())
+    {
+      _mqtt.loop();
+    }
+
+    // Publish any telemetry raised by our MQTT callbacks
+    if (!_pendingTelemetry.isNull())
+    {
+      publishTelemetry(_pendingTelemetry.as<JsonVariant>());
+      _pendingTelemetry.clear();
+    }
+
+    // Handle any REST API requests
+#if defined(ETH_MODE)
+    EthernetClient client = _server.available();
+#else
+    WiFiClient client = _server.available();
+#endif
+    if (client)
+    {
+      _handleRestClient(client);
+
+      if (_otaRestartPending)
+      {
+        _logger.println(F("[wt32] restarting into new firmware"));
+        client.stop();
+        ESP.restart();
+      }
+    }
+  }
+
+  // Flush any batched telemetry once the oldest sample is due
+  if (!_telemetryBatch.isNull() && (millis() - _telemetryBatchStart) > _telemetryBatchMaxAgeMs)
+  {
+    _flushTelemetryBatch();
+  }
+
+  // Replay any spooled telemetry
+  _replayTelemetrySpool();
+
+  // Check for climate update
+  _updateClimateSensor();
+
+  // Check for system health update
+  _updateSystemTelemetry();
+
+  // Format any deferred log records
+  _drainLogRecords();
+
+  // Persist any buffered log output
+  if (_logBufferLength > 0 && (millis() - _logBufferStart) > LOG_FLUSH_MS)
+  {
+    _flushLogStore();
+  }
+
+  // Deliver any status change events
+  _dispatchEvents();
+}
+
+void OXRS_WT32::setConfigSchema(JsonVariant json)
+{
+  _fwConfigSchema.clear();
+  _mergeJson(_fwConfigSchema.as<JsonVariant>(), json);
+
+  _schemaProgramsDirty = true;
+}
+
+void OXRS_WT32::setCommandSchema(JsonVariant json)
+{
+  _fwCommandSchema.clear();
+  _mergeJson(_fwCommandSchema.as<JsonVariant>(), json);
+
+  _schemaProgramsDirty = true;
+}
+
+boolean OXRS_WT32::onConfigKey(const char *key, jsonCallback callback)
+{
+  return _addKeyHandler(_configKeyHandlers, key, callback);
+}
+
+boolean OXRS_WT32::onCommandKey(const char *key, jsonCallback callback)
+{
+  return _addKeyHandler(_commandKeyHandlers, key, callback);
+}
+
+ArduinoJson::Allocator *OXRS_WT32::getJsonAllocator(allocPolicy_t policy)
+{
+  return policy == ALLOC_PSRAM ? &_psRamAllocator : &_jsonAllocator;
+}
+
+void OXRS_WT32::onConfigDelta(jsonCallback callback)
+{
+  _onConfigDelta = callback;
+}
+
+void OXRS_WT32::setAdoptSchemaHashes(boolean enabled)
+{
+  _adoptSchemaHashes = enabled;
+  _adoptVersion++;
+}
+
+void OXRS_WT32::setPayloadCompression(boolean enabled)
+{
+  _payloadCompression = enabled;
+}
+
+void OXRS_WT32::serveStatic(const char *path, const char *directory)
+{
+  _staticPath = path;
+  _staticDirectory = directory;
+}
+
+void OXRS_WT32::apiGet(const char *path, Router::Middleware *middleware)
+{
+  _api.get(path, middleware);
+}
+
+void OXRS_WT32::apiPost(const char *path, Router::Middleware *middleware)
+{
+  _api.post(path, middleware);
+}
+
+boolean OXRS_WT32::publishStatus(JsonVariant json)
+{
+  // Exit early if no network connection
+  if (!_isNetworkConnected())
+  {
+    return false;
+  }
+
+  if (_statusFormat == FORMAT_MSGPACK)
+  {
+    char topic[64];
+    return _publishMsgPack(_mqtt.getStatusTopic(topic), json);
+  }
+
+  boolean success = _mqtt.publishStatus(json);
+  return success;
+}
+
+boolean OXRS_WT32::publishTelemetry(JsonVariant json)
+{
+  HEAP_PROFILE(HEAP_SITE_TELEMETRY);
+
+  // Exit early if no network connection, spooling for later (if enabled)
+  if (!_isNetworkConnected())
+  {
+    _spoolTelemetry(json);
+    return false;
+  }
+
+  if (_telemetryBatchMaxBytes > 0)
+  {
+    return _batchTelemetry(json);
+  }
+
+  boolean success = _publishTelemetry(json);
+  if (!success)
+  {
+    _spoolTelemetry(json);
+  }
+
+  return success;
+}
+
+void OXRS_WT32::setTelemetrySpool(uint32_t maxBytes)
+{
+  _spoolMaxBytes = maxBytes;
+}
+
+void OXRS_WT32::setTelemetryBatching(uint16_t maxBytes, uint32_t maxAgeMs)
 {
-  _mqtt.setTopicPrefix(prefix);
+  // Don't mix samples batched under the old settings
+  _flushTelemetryBatch();
+
+  _telemetryBatchMaxBytes = maxBytes;
+  _telemetryBatchMaxAgeMs = maxAgeMs;
 }
 
-void OXRS_WT32::setMqttTopicSuffix(const char *suffix)
+boolean OXRS_WT32::_publishTelemetry(JsonVariant json)
 {
-  _mqtt.setTopicSuffix(suffix);
+  if (_telemetryFormat == FORMAT_MSGPACK)
+  {
+    char topic[64];
+    return _publishMsgPack(_mqtt.getTelemetryTopic(topic), json);
+  }
+
+  boolean success = _mqtt.publishTelemetry(json);
+  return success;
 }
 
-void OXRS_WT32::begin(jsonCallback config, jsonCallback command, climateUpdateCallback climateUpdate)
+boolean OXRS_WT32::_batchTelemetry(JsonVariant json)
 {
-  // Get our firmware details
-  JsonDocument json;
-  _getFirmwareJson(json.as<JsonVariant>());
+  // Start a new batch if needed, sample offsets are relative to this
+  JsonArray samples = _telemetryBatch["samples"].as<JsonArray>();
+  if (samples.isNull())
+  {
+    samples = _telemetryBatch["samples"].to<JsonArray>();
+    _telemetryBatchStart = millis();
+    _telemetryBatchFormat = _telemetryFormat;
+  }
 
-  // Log firmware details
-  _logger.print(F("[wt32] "));
-  serializeJson(json, _logger);
-  _logger.println();
+  JsonObject sample = samples.add<JsonObject>();
+  sample["offsetMs"] = millis() - _telemetryBatchStart;
+  sample["data"] = json;
 
-  // We wrap the callbacks so we can intercept messages intended for the WT32
-  _onConfig = config;
-  _onCommand = command;
+  // Track the frame size as we go rather than re-measuring the whole batch
+  _telemetryBatchBytes += measureJson(sample);
+  if (_telemetryBatchBytes >= _telemetryBatchMaxBytes)
+  {
+    return _flushTelemetryBatch();
+  }
 
-  // Set up network and obtain an IP address
-  byte mac[6];
-  _initialiseNetwork(mac);
+  return true;
+}
 
-  // Set up MQTT (don't attempt to connect yet)
-  _initialiseMqtt(mac);
+boolean OXRS_WT32::_flushTelemetryBatch(void)
+{
+  if (_telemetryBatch.isNull())
+  {
+    return true;
+  }
 
-  // Set up the REST API
-  _initialiseRestApi();
+  // Samples batched as JSON may hold pre-formatted values, which need parsing
+  // if the telemetry format has since been switched to MessagePack
+  JsonDocument parsed(&_psRamAllocator);
+  JsonVariant batch = _telemetryBatch.as<JsonVariant>();
+  if (_telemetryBatchFormat != _telemetryFormat && _parseRawJson(batch, parsed))
+  {
+    batch = parsed.as<JsonVariant>();
+  }
 
-  // upstream callback
-  _onClimateUpdate = climateUpdate;
+  boolean success = _isNetworkConnected() && _publishTelemetry(batch);
+  if (!success)
+  {
+    _spoolTelemetry(batch);
+  }
 
-  // Set up the climate sensor(s)
-  _initialiseClimateSensor();
+  _telemetryBatch.clear();
+  _telemetryBatchBytes = 0;
+
+  return success;
 }
 
-void OXRS_WT32::loop(void)
+void OXRS_WT32::_replayTelemetrySpool(void)
 {
-  // Check our network connection
-  if (_isNetworkConnected())
+  // Flush staged records to flash periodically while offline
+  if (_spoolBufferLength > 0 && (millis() - _spoolBufferStart) > SPOOL_FLUSH_MS)
   {
-    // Maintain our DHCP lease
-#if defined(ETH_MODE)
-    Ethernet.maintain();
-#endif
+    _flushTelemetrySpool();
+  }
 
-    // Handle any MQTT messages
-    _mqtt.loop();
+  // Nothing to replay, or not connected
+  if ((_spoolFileBytes == 0 && _spoolBufferLength == 0) || !_mqtt.connected())
+  {
+    return;
+  }
 
-    // Handle any REST API requests
-#if defined(ETH_MODE)
-    EthernetClient client = _server.available();
-    _api.loop(&client);
-#else
-    WiFiClient client = _server.available();
-    _api.loop(&client);
-#endif
+  // Replay one record at a time, rate limited, so we don't flood the broker
+  if ((millis() - _lastSpoolReplay) < SPOOL_REPLAY_INTERVAL_MS)
+  {
+    return;
   }
+  _lastSpoolReplay = millis();
 
-  // Check for climate update
-  _updateClimateSensor();
+  // Ensure staged records are replayed in order
+  _flushTelemetrySpool();
+
+  File file = LittleFS.open(SPOOL_FILE, "r");
+  if (!file)
+  {
+    _resetTelemetrySpool();
+    return;
+  }
+
+  spoolRecordHeader_t header;
+  uint8_t payload[SPOOL_MAX_RECORD_BYTES];
+
+  file.seek(_spoolReadOffset);
+  boolean valid = _readSpoolRecord(file, &header, payload);
+  file.close();
+
+  JsonDocument json(&_jsonAllocator);
+  if (valid && !deserializeMsgPack(json, payload, header.length))
+  {
+    // Records spooled since boot can tell how long ago they were captured
+    if (_spoolReadOffset >= _spoolBootOffset && json.is<JsonObject>())
+    {
+      json["spoolAgeMs"] = millis() - header.timestamp;
+    }
+
+    // Try again next time if this fails, unless it keeps failing while we
+    // are connected, in which case skip it rather than block the spool
+    if (_publishTelemetry(json.as<JsonVariant>()))
+    {
+      _spoolReplayed++;
+    }
+    else if (++_spoolRetries < SPOOL_MAX_RETRIES)
+    {
+      return;
+    }
+    else
+    {
+      _logger.println(F("[wt32] dropping telemetry spool record, publish keeps failing"));
+      _spoolDropped++;
+    }
+  }
+
+  _spoolRetries = 0;
+  _spoolReadOffset += sizeof(header) + header.length;
+
+  // Once the spool is drained, remove it and report what we replayed/dropped
+  if (!valid || _spoolReadOffset >= _spoolFileBytes)
+  {
+    _resetTelemetrySpool();
+
+    JsonDocument spool(&_jsonAllocator);
+    spool["spool"]["replayed"] = _spoolReplayed;
+    spool["spool"]["dropped"] = _spoolDropped;
+    _publishTelemetry(spool.as<JsonVariant>());
+
+    _spoolReplayed = 0L;
+    _spoolDropped = 0L;
+  }
 }
 
-void OXRS_WT32::setConfigSchema(JsonVariant json)
+void OXRS_WT32::setStatusFormat(payloadFormat_t format)
 {
-  _fwConfigSchema.clear();
-  _mergeJson(_fwConfigSchema.as<JsonVariant>(), json);
+  _statusFormat = format;
+  _adoptVersion++;
 }
 
-void OXRS_WT32::setCommandSchema(JsonVariant json)
+void OXRS_WT32::setTelemetryFormat(payloadFormat_t format)
 {
-  _fwCommandSchema.clear();
-  _mergeJson(_fwCommandSchema.as<JsonVariant>(), json);
+  _telemetryFormat = format;
+  _adoptVersion++;
 }
 
-void OXRS_WT32::apiGet(const char *path, Router::Middleware *middleware)
+void OXRS_WT32::invalidateFileSystemStats(void)
 {
-  _api.get(path, middleware);
+  _invalidateFileSystemStats();
 }
 
-void OXRS_WT32::apiPost(const char *path, Router::Middleware *middleware)
+void OXRS_WT32::logRecord(const char *format, int32_t arg)
 {
-  _api.post(path, middleware);
+  _logRecord(format, arg);
 }
 
-boolean OXRS_WT32::publishStatus(JsonVariant json)
+void OXRS_WT32::_drainLogRecords(void)
 {
-  // Exit early if no network connection
-  if (!_isNetworkConnected())
+  if (_logRingDropped > 0)
   {
-    return false;
+    _logger.print(F("[wt32] log records dropped: "));
+    _logger.println(_logRingDropped);
+    _logRingDropped = 0L;
   }
 
-  boolean success = _mqtt.publishStatus(json);
-  return success;
-}
-
-boolean OXRS_WT32::publishTelemetry(JsonVariant json)
-{
-  // Exit early if no network connection
-  if (!_isNetworkConnected())
+  while (_logRingCount > 0)
   {
-    return false;
+    logRecord_t record = _logRing[_logRingHead];
+    _logRingHead = (_logRingHead + 1) % LOG_RING_SIZE;
+    _logRingCount--;
+
+    // Records are formatted later, so note when they actually happened
+    _logger.printf(record.format, record.arg);
+    _logger.print(F(" (at "));
+    _logger.print(record.timestamp);
+    _logger.println(F("ms)"));
   }
-
-  boolean success = _mqtt.publishTelemetry(json);
-  return success;
 }
 
 size_t OXRS_WT32::write(uint8_t character)
@@ -471,6 +2714,51 @@ size_t OXRS_WT32::write(uint8_t character)
   return _logger.write(character);
 }
 
+void OXRS_WT32::_initialiseConfig(void)
+{
+  // Register our core config/command key handlers
+  _addKeyHandler(_configKeyHandlers, "climateUpdateSeconds", _configClimateUpdateSeconds);
+  _addKeyHandler(_configKeyHandlers, "systemUpdateSeconds", _configSystemUpdateSeconds);
+  _addKeyHandler(_configKeyHandlers, "statusFormat", _configStatusFormat);
+  _addKeyHandler(_configKeyHandlers, "telemetryFormat", _configTelemetryFormat);
+  _addKeyHandler(_commandKeyHandlers, "adopt", _commandAdopt);
+  _addKeyHandler(_commandKeyHandlers, "restart", _commandRestart);
+
+  // Replay the last applied config (if any)
+  File file = LittleFS.open(CONFIG_CACHE_FILE, "r");
+  if (!file)
+  {
+    return;
+  }
+
+  size_t length = file.size() > sizeof(_configCacheHash) ? file.size() - sizeof(_configCacheHash) : 0;
+  char *payload = (char *)_psRamAllocator.allocate(length);
+
+  if (payload &&
+      file.read((uint8_t *)&_configCacheHash, sizeof(_configCacheHash)) == sizeof(_configCacheHash) &&
+      file.read((uint8_t *)payload, length) == length)
+  {
+    _logger.println(F("[wt32] applying cached config"));
+
+    // Same path as config received via MQTT
+    if (_mqttStreaming && length > MQTT_STREAMING_THRESHOLD_BYTES)
+    {
+      _streamReceive(payload, length, _mqttConfig);
+    }
+    else
+    {
+      JsonDocument json(&_jsonAllocator);
+      if (!deserializeJson(json, payload, length))
+      {
+        _mqttConfig(json.as<JsonVariant>());
+      }
+    }
+  }
+
+  file.close();
+  _psRamAllocator.deallocate(payload);
+}
+
 void OXRS_WT32::_initialiseNetwork(byte *mac)
 {
   // Get WiFi base MAC address
@@ -484,7 +2772,7 @@ void OXRS_WT32::_initialiseNetwork(byte *mac)
 
   // Format the MAC address for logging
   char mac_display[18];
-  sprintf_P(mac_display, PSTR("%02X:%02X:%02X:%02X:%02X:%02X"), mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+  _formatMACAddress(mac_display, mac);
 
 #if defined(ETH_MODE)
   _logger.print(F("[wt32] ethernet mac address: "));
@@ -501,9 +2789,13 @@ void OXRS_WT32::_initialiseNetwork(byte *mac)
   delay(50);
   digitalWrite(WIZNET_RST_PIN, HIGH);
   delay(350);
+  _markBootStep("network.reset");
 
   // Connect ethernet and get an IP address via DHCP
-  if (!Ethernet.begin(mac, DHCP_TIMEOUT_MS, DHCP_RESPONSE_TIMEOUT_MS))
+  boolean dhcpAcquired = Ethernet.begin(mac, DHCP_TIMEOUT_MS, DHCP_RESPONSE_TIMEOUT_MS);
+  _markBootStep("network.dhcp");
+
+  if (!dhcpAcquired)
   {
     if (Ethernet.hardwareStatus() == EthernetNoHardware)
     {
@@ -544,12 +2836,19 @@ void OXRS_WT32::_initialiseNetwork(byte *mac)
     _logger.println(F("[wt32] failed to connect to wifi access point, rebooting"));
     ESP.restart();
   }
+  _markBootStep("network.wifi");
 
   IPAddress ipAddress = WiFi.localIP();
 #endif
 
   _logger.print(F("[wt32] ip address: "));
   _logger.println(ipAddress);
+
+  // WiFi raises this on its first link up in loop(), like any reconnect
+#if defined(ETH_MODE)
+  _queueEvent(EVENT_IP_ACQUIRED, 0);
+  _adoptVersion++;
+#endif
 }
 
 void OXRS_WT32::_initialiseMqtt(byte *mac)
@@ -562,6 +2861,12 @@ void OXRS_WT32::_initialiseMqtt(byte *mac)
   sprintf_P(clientId, PSTR("%02x%02x%02x"), mac[3], mac[4], mac[5]);
   _mqtt.setClientId(clientId);
 
+  // Seed our reconnect jitter from the MAC address and stagger the
+  // first connection attempt, in case the whole fleet just powered up
+  _mqttJitterState = ((uint32_t)mac[2] << 24 | (uint32_t)mac[3] << 16 | (uint32_t)mac[4] << 8 | mac[5]) | 1;
+  _mqttReconnectWaitMs = _mqttJitter() % MQTT_RECONNECT_MIN_MS;
+  _mqttReconnectLastMs = millis();
+
   // Register our callbacks
   _mqtt.onConnected(_mqttConnected);
   _mqtt.onDisconnected(_mqttDisconnected);
@@ -580,10 +2885,26 @@ void OXRS_WT32::_initialiseRestApi(void)
 
   // Set up the REST API
   _api.begin();
+  _markBootStep("restApi.begin");
 
   // Register our callbacks
   _api.onAdopt(_apiAdopt);
 
+  // Persisted logs, if the API managed to mount (or format) the file system
+  // (begin() just reports the existing mount if it did)
+  _logStoreReady = LittleFS.begin();
+  _api.get("/logs", &_apiGetLogs);
+
+  // Full schemas (for when adoption only carries their hashes)
+  _api.get("/configSchema", &_apiGetConfigSchema);
+  _api.get("/commandSchema", &_apiGetCommandSchema);
+
+  // Firmware updates (if enabled)
+  if (_otaEnabled)
+  {
+    _api.post("/ota", &_apiPostOta);
+  }
+
   // Start listening
   _server.begin();
 }
@@ -611,6 +2932,65 @@ void OXRS_WT32::_initialiseClimateSensor(void)
   _lastClimateUpdate = -_climateUpdateMs;
 }
 
+void OXRS_WT32::_initialiseTelemetrySpool(void)
+{
+  // NOTE: this must be called *after* initialising the REST API since
+  //       that mounts the file system
+  File file = LittleFS.open(SPOOL_FILE, "r");
+  if (!file)
+  {
+    return;
+  }
+
+  // Find the end of the last complete record
+  spoolRecordHeader_t header;
+  uint8_t payload[SPOOL_MAX_RECORD_BYTES];
+  uint32_t validBytes = 0L;
+
+  while (_readSpoolRecord(file, &header, payload))
+  {
+    validBytes += sizeof(header) + header.length;
+  }
+
+  uint32_t fileBytes = file.size();
+  file.close();
+
+  // Drop any partially written record from the tail, by copying the
+  // complete records to a new file (LittleFS can't truncate)
+  if (validBytes < fileBytes)
+  {
+    _logger.println(F("[wt32] discarding partial telemetry spool record"));
+
+    File src = LittleFS.open(SPOOL_FILE, "r");
+    File dst = LittleFS.open(SPOOL_FILE ".tmp", "w");
+    if (src && dst)
+    {
+      uint32_t remaining = validBytes;
+      while (remaining > 0)
+      {
+        size_t length = src.read(payload, min(remaining, (uint32_t)sizeof(payload)));
+        if (length == 0)
+        {
+          break;
+        }
+        dst.write(payload, length);
+        remaining -= length;
+      }
+    }
+    src.close();
+    dst.close();
+
+    LittleFS.remove(SPOOL_FILE);
+    LittleFS.rename(SPOOL_FILE ".tmp", SPOOL_FILE);
+    _invalidateFileSystemStats();
+  }
+
+  // Everything in the spool right now was captured before this boot
+  _spoolFileBytes = validBytes;
+  _spoolReadOffset = 0L;
+  _spoolBootOffset = validBytes;
+}
+
 // get values from climate sensor, store local, publish /tele
 void OXRS_WT32::_updateClimateSensor(void)
 {
@@ -623,13 +3003,15 @@ void OXRS_WT32::_updateClimateSensor(void)
   // Check if we need to get new readings and publish
   if ((millis() - _lastClimateUpdate) > _climateUpdateMs)
   {
+    HEAP_PROFILE(HEAP_SITE_CLIMATE);
+
     float tempESP;
-    JsonDocument json;
+    JsonDocument json(&_jsonAllocator);
 
 #if defined(CONFIG_IDF_TARGET_ESP32S3)
     // read temperature from ESP chip
     temp_sensor_read_celsius(&tempESP);
-    json["esp32Temp"] = round(tempESP);
+    json["esp32Temp"] = lroundf(tempESP);
 #endif
 
     if (_sht20Found)
@@ -637,13 +3019,25 @@ void OXRS_WT32::_updateClimateSensor(void)
       // Read values from onboard sensor
       sht.read();
 
-      int temperature = round(sht.getTemperature() * 10);
-      int humidity = round(sht.getHumidity() * 10);
-      _temperature = (double)temperature / 10.0;
-      _humidity = (double)humidity / 10.0;
+      // Convert to fixed-point once, using single precision (hardware) floats
+      _temperature = lroundf(sht.getTemperature() * 10.0f);
+      _humidity = lroundf(sht.getHumidity() * 10.0f);
 
-      json["temperature"] = _temperature;
-      json["humidity"] = _humidity;
+      // JSON is formatted straight from the tenths, rather than converting to
+      // double (soft-float) and formatting that, MessagePack gets a float
+      if (_telemetryFormat == FORMAT_JSON)
+      {
+        char value[8];
+        _formatDeci(value, _temperature);
+        json["temperature"] = serialized(value);
+        _formatDeci(value, _humidity);
+        json["humidity"] = serialized(value);
+      }
+      else
+      {
+        json["temperature"] = _temperature / 10.0f;
+        json["humidity"] = _humidity / 10.0f;
+      }
 
       // update screen
       if (_onClimateUpdate)
@@ -663,13 +3057,71 @@ void OXRS_WT32::_updateClimateSensor(void)
   }
 }
 
+// publish any system stats which have changed significantly to /tele
+void OXRS_WT32::_updateSystemTelemetry(void)
+{
+  // Ignore if disabled
+  if (_systemUpdateMs == 0)
+  {
+    return;
+  }
+
+  if ((millis() - _lastSystemUpdate) > _systemUpdateMs)
+  {
+    JsonDocument system(&_jsonAllocator);
+    _getSystemJson(system.as<JsonVariant>());
+
+    JsonDocument json(&_jsonAllocator);
+    JsonObject delta = json["system"].to<JsonObject>();
+
+    for (JsonPair kvp : system["system"].as<JsonObject>())
+    {
+      int64_t value = kvp.value().as<int64_t>();
+      JsonVariant last = _lastSystemJson[kvp.key()];
+
+      if (last.isNull() || abs(value - last.as<int64_t>()) >= SYSTEM_DELTA_THRESHOLD_BYTES)
+      {
+        delta[kvp.key()] = value;
+      }
+    }
+
+    boolean changed = delta.size() > 0;
+
+#if defined(HEAP_PROFILING)
+    // Always report the heap profile when profiling
+    _sampleHeapFragmentation();
+    _getHeapProfileJson(json.as<JsonVariant>());
+    changed = true;
+#endif
+
+    // Publish only if something has changed, and only consider it
+    // reported once successfully published
+    if (changed && publishTelemetry(json.as<JsonVariant>()))
+    {
+      _mergeJson(_lastSystemJson.as<JsonVariant>(), delta);
+    }
+
+    // Reset our timer
+    _lastSystemUpdate = millis();
+  }
+}
+
 // get climate sensor values
 bool OXRS_WT32::getClimate(float *temperature, float *humidity)
 {
-  *temperature = (float)_temperature;
-  *humidity = (float)_humidity;
+  *temperature = _temperature != CLIMATE_INVALID ? _temperature / 10.0f : NAN;
+  *humidity = _humidity != CLIMATE_INVALID ? _humidity / 10.0f : NAN;
+
+  return (_temperature != CLIMATE_INVALID) && (_humidity != CLIMATE_INVALID);
+}
+
+// get climate sensor values in fixed-point tenths
+bool OXRS_WT32::getClimateDeci(int16_t *temperature, int16_t *humidity)
+{
+  *temperature = _temperature;
+  *humidity = _humidity;
 
-  return (isnan(_temperature) || isnan(_humidity)) == false;
+  return (_temperature != CLIMATE_INVALID) && (_humidity != CLIMATE_INVALID);
 }
 
 boolean OXRS_WT32::_isNetworkConnected(void)
@@ -693,6 +3145,83 @@ connectionState_t OXRS_WT32::getConnectionState(void)
 
 void OXRS_WT32::getIPAddressTxt(char *buffer)
 {
+  if (_statusTxtDirty)
+  {
+    _updateStatusTxt();
+  }
+
+  strcpy(buffer, _ipAddressTxt);
+}
+
+void OXRS_WT32::getMACAddressTxt(char *buffer)
+{
+  if (_statusTxtDirty)
+  {
+    _updateStatusTxt();
+  }
+
+  strcpy(buffer, _macAddressTxt);
+}
+
+void OXRS_WT32::getMQTTTopicTxt(char *buffer)
+{
+  if (_statusTxtDirty)
+  {
+    _updateStatusTxt();
+  }
+
+  strcpy(buffer, _mqttTopicTxt);
+}
+
+boolean OXRS_WT32::onEvent(eventCallback callback)
+{
+  for (uint8_t i = 0; i < MAX_EVENT_SUBSCRIBERS; i++)
+  {
+    if (!_eventSubscribers[i])
+    {
+      _eventSubscribers[i] = callback;
+      return true;
+    }
+  }
+
+  // No free subscriber slots
+  return false;
+}
+
+void OXRS_WT32::_dispatchEvents(void)
+{
+  while (_eventQueueCount > 0)
+  {
+    eventQueueItem_t item = _eventQueue[_eventQueueHead];
+    _eventQueueHead = (_eventQueueHead + 1) % EVENT_QUEUE_SIZE;
+    _eventQueueCount--;
+
+    for (uint8_t i = 0; i < MAX_EVENT_SUBSCRIBERS; i++)
+    {
+      if (_eventSubscribers[i])
+      {
+        _eventSubscribers[i](item.event, item.data);
+      }
+    }
+  }
+}
+
+uint32_t OXRS_WT32::getStatusGeneration(void)
+{
+  if (_statusTxtDirty)
+  {
+    _updateStatusTxt();
+  }
+
+  return _statusGeneration;
+}
+
+void OXRS_WT32::_updateStatusTxt(void)
+{
+  char ipAddressTxt[16];
+  char macAddressTxt[18];
+  char mqttTopicTxt[40];
+
   IPAddress ip = IPAddress(0, 0, 0, 0);
 
   if (_isNetworkConnected())
@@ -706,16 +3235,13 @@ void OXRS_WT32::getIPAddressTxt(char *buffer)
 
   if (ip[0] == 0)
   {
-    sprintf(buffer, "---.---.---.---");
+    strcpy(ipAddressTxt, "---.---.---.---");
   }
   else
   {
-    sprintf(buffer, "%03d.%03d.%03d.%03d", ip[0], ip[1], ip[2], ip[3]);
+    _formatIPAddress(ipAddressTxt, ip);
   }
-}
 
-void OXRS_WT32::getMACAddressTxt(char *buffer)
-{
   byte mac[6];
 
 #if defined(ETH_MODE)
@@ -724,23 +3250,32 @@ void OXRS_WT32::getMACAddressTxt(char *buffer)
   WiFi.macAddress(mac);
 #endif
 
-  sprintf(buffer, "%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
-}
-
-void OXRS_WT32::getMQTTTopicTxt(char *buffer)
-{
-  char topic[64];
+  _formatMACAddress(macAddressTxt, mac);
 
   if (!_mqtt.connected())
   {
-    sprintf(buffer, "-/------");
+    strcpy(mqttTopicTxt, "-/------");
   }
   else
   {
+    char topic[64];
     _mqtt.getWildcardTopic(topic);
-    strcpy(buffer, "");
-    strncat(buffer, topic, 39);
+    strcpy(mqttTopicTxt, "");
+    strncat(mqttTopicTxt, topic, 39);
   }
+
+  // Only bump the generation if something visible has changed
+  if (strcmp(ipAddressTxt, _ipAddressTxt) != 0 ||
+      strcmp(macAddressTxt, _macAddressTxt) != 0 ||
+      strcmp(mqttTopicTxt, _mqttTopicTxt) != 0)
+  {
+    strcpy(_ipAddressTxt, ipAddressTxt);
+    strcpy(_macAddressTxt, macAddressTxt);
+    strcpy(_mqttTopicTxt, mqttTopicTxt);
+    _statusGeneration++;
+  }
+
+  _statusTxtDirty = false;
 }
 
 void OXRS_WT32::setFwVersion(const char *version)
@@ -18,15 +18,96 @@
 // REST API
 #define REST_API_PORT               80
 
+// Offline telemetry spool (records are MessagePack encoded)
+#define SPOOL_FILE                  "/tele.spool"
+#define SPOOL_RECORD_MAGIC          0x5350
+#define SPOOL_MAX_RECORD_BYTES      512
+#define SPOOL_BUFFER_BYTES          1024
+#define SPOOL_FLUSH_MS              60000L
+#define SPOOL_REPLAY_INTERVAL_MS    200L
+#define SPOOL_MAX_RETRIES           10
+
+// On-flash log store - log output is batched into page sized writes
+// and rotated between two files (served via GET /logs)
+#define LOG_FILE                    "/log.0"
+#define LOG_FILE_PREVIOUS           "/log.1"
+#define LOG_FILE_MAX_BYTES          16384
+#define LOG_PAGE_BYTES              512
+#define LOG_FLUSH_MS                30000L
+
+// Deferred log records, formatted when drained to the log sinks from loop()
+#define LOG_RING_SIZE               32
+
+// Last applied config payload, replayed on boot before the network is up
+#define CONFIG_CACHE_FILE           "/config.cache"
+
+// Hash of the last published (retained) adoption payload
+#define ADOPT_HASH_FILE             "/adopt.hash"
+
+// Static assets (optionally pre-gzipped) served straight from the file system
+#define STATIC_ASSET_PATH_BYTES     64
+#define STATIC_ASSET_MAX_AGE        "31536000"
+#define FILE_STREAM_BYTES           512
+
+// Boot timeline, phases/sub-steps of begin() timestamped for cold-start profiling
+#define BOOT_TIMELINE_SIZE          16
+
 // Climate sensor update internal
 #define DEFAULT_CLIMATE_UPDATE_MS   60000L
 
+// MQTT payloads larger than this are parsed one top-level key at a time
+#define MQTT_STREAMING_THRESHOLD_BYTES  1024
+
+// MQTT reconnect backoff (doubles on each failure, with random jitter)
+#define MQTT_RECONNECT_MIN_MS           1000L
+#define MQTT_RECONNECT_MAX_MS           300000L
+
+// System health telemetry - only stats which have changed by at least the
+// threshold since they were last reported are published (disabled by default)
+#define DEFAULT_SYSTEM_UPDATE_MS        0L
+#define SYSTEM_DELTA_THRESHOLD_BYTES    1024
+
+// Heap profiling - build with -DHEAP_PROFILING to count JSON allocations per
+// library call site and track a heap fragmentation trend in system telemetry
+#define HEAP_PROFILE_TREND_SIZE         12
+
+// Status change event queue/subscribers
+#define EVENT_QUEUE_SIZE                8
+#define MAX_EVENT_SUBSCRIBERS           4
+
+// Config snapshot used to work out config deltas (max top-level keys tracked)
+#define MAX_CONFIG_SNAPSHOT_KEYS        64
+
+// Config/command key handler tables (must be a power of 2)
+#define MAX_KEY_HANDLERS            32
+
 // Enum for the different connection states
 enum connectionState_t { CONNECTED_NONE, CONNECTED_IP, CONNECTED_MQTT };
 
+// Enum for the different status change events
+enum wt32Event_t { EVENT_LINK_UP, EVENT_LINK_DOWN, EVENT_IP_ACQUIRED, EVENT_MQTT_CONNECTED, EVENT_MQTT_DISCONNECTED, EVENT_CONFIG_RECEIVED };
+
+// Enum for the different stat/ and tele/ payload encodings
+enum payloadFormat_t { FORMAT_JSON, FORMAT_MSGPACK };
+
+// Enum for where JSON document memory is allocated - large/cold documents can go
+// in PSRAM (if available) to leave internal SRAM free for hot data and the display
+enum allocPolicy_t { ALLOC_INTERNAL, ALLOC_PSRAM };
+
 // callback to signal upstream climate values have changed
 typedef void (*climateUpdateCallback)(void);
 
+// callback to signal a status change event, data is the PubSubClient
+// state (i.e. disconnect reason) for EVENT_MQTT_DISCONNECTED, otherwise 0
+typedef void (*eventCallback)(wt32Event_t event, int data);
+
+// FNV-1a hash of a config/command key - constexpr so firmware can also
+// switch on key hashes, e.g. case oxrsKeyHash("brightness"):
+constexpr uint32_t oxrsKeyHash(const char *key, uint32_t hash = 2166136261UL)
+{
+  return *key ? oxrsKeyHash(key + 1, (hash ^ (uint8_t)*key) * 16777619UL) : hash;
+}
+
 class OXRS_WT32 : public Print
 {
 public:
@@ -38,6 +119,15 @@ public:
   void setMqttTopicPrefix(const char *prefix);
   void setMqttTopicSuffix(const char *suffix);
 
+  // Increase the MQTT buffer to allow larger payloads
+  boolean setMqttBufferSize(uint16_t size);
+
+  // Parse any config/command payload larger than MQTT_STREAMING_THRESHOLD_BYTES one
+  // top-level key at a time, so the key handlers and config/command callbacks get
+  // a separate single-key document for each (the payload is fully parsed and
+  // validated first, so a bad payload is never partially applied)
+  void setMqttStreaming(boolean enabled);
+
   void begin(jsonCallback config, jsonCallback command, climateUpdateCallback climateUpdate);
   void loop(void);
 
@@ -49,6 +139,40 @@ public:
   void setConfigSchema(JsonVariant json);
   void setCommandSchema(JsonVariant json);
 
+  // Firmware can register handlers for individual config/command keys, these are
+  // dispatched in a single pass over each payload, before the config/command callbacks
+  // NOTE: the key is not copied so must be a string literal (or otherwise persist)
+  boolean onConfigKey(const char *key, jsonCallback callback);
+  boolean onCommandKey(const char *key, jsonCallback callback);
+
+  // Firmware can register a callback which only receives the top-level config keys
+  // which were added/changed since the last config - config payloads can be partial,
+  // so a missing key is unchanged and a key is only removed by setting it to null
+  void onConfigDelta(jsonCallback callback);
+
+  // Allocator for firmware JsonDocuments, e.g. JsonDocument json(wt32.getJsonAllocator(ALLOC_PSRAM));
+  // PSRAM allocations fall back to internal SRAM if there is no PSRAM available
+  ArduinoJson::Allocator *getJsonAllocator(allocPolicy_t policy);
+
+  // Adoption payloads carry just a hash of the config/command schemas, rather than
+  // the full schemas, which are then fetched via GET /configSchema and /commandSchema
+  void setAdoptSchemaHashes(boolean enabled);
+
+  // Gzip compress the adoption payload published to MQTT (identifiable by the gzip
+  // magic bytes) and the schemas served via REST (sent with Content-Encoding: gzip
+  // to clients which accept it), the schemas are cached in PSRAM until they change
+  void setPayloadCompression(boolean enabled);
+
+  // Serve files from a file system directory under this REST path, preferring a
+  // pre-gzipped "<file>.gz" if the client accepts gzip (e.g. "/ui", "/www"), both
+  // strings must stay valid while the REST API is running
+  void serveStatic(const char *path, const char *directory);
+
+  // Register POST /ota, which streams a firmware image (optionally verified with
+  // ?md5=) into the inactive partition and restarts into it - the REST API is
+  // unauthenticated, so this is opt-in and must be called before begin()
+  void enableOta(void);
+
   // Helpers for registering custom REST API endpoints
   void apiGet(const char *path, Router::Middleware *middleware);
   void apiPost(const char *path, Router::Middleware *middleware);
@@ -57,12 +181,43 @@ public:
   boolean publishStatus(JsonVariant json);
   boolean publishTelemetry(JsonVariant json);
 
+  // Spool telemetry to LittleFS (up to maxBytes) when it can't be published, it is
+  // then replayed at a controlled rate once reconnected (zero bytes disables)
+  void setTelemetrySpool(uint32_t maxBytes);
+
+  // Select the stat/ and tele/ payload encodings (also configurable via the
+  // "statusFormat" and "telemetryFormat" config options) - JSON by default
+  void setStatusFormat(payloadFormat_t format);
+  void setTelemetryFormat(payloadFormat_t format);
+
+  // Batch telemetry payloads into a single tele/ publish, with each sample offset
+  // (ms) from the first in the batch - flushed once maxBytes of samples are queued
+  // or the oldest sample is maxAgeMs old (zero bytes disables batching)
+  void setTelemetryBatching(uint16_t maxBytes, uint32_t maxAgeMs);
+
   // Helpers for retrieving the connection status and properties
   connectionState_t getConnectionState(void);
   void getIPAddressTxt(char *buffer);
   void getMACAddressTxt(char *buffer);
   void getMQTTTopicTxt(char *buffer);
 
+  // Subscribe to status change events, so the UI can update on transitions rather
+  // than polling - events are queued and delivered from loop()
+  boolean onEvent(eventCallback callback);
+
+  // Incremented whenever the IP address, MAC address or MQTT topic text changes,
+  // so the UI can skip redrawing the status screen if nothing has changed
+  uint32_t getStatusGeneration(void);
+
+  // File system usage is cached for adoption/health reports, firmware should call
+  // this after writing to LittleFS directly so the figures are refreshed
+  void invalidateFileSystemStats(void);
+
+  // Log a compact record (format + one integer arg) which is formatted later, from
+  // loop(), rather than at the call site - the format is not copied, so must be a
+  // string literal, e.g. wt32.logRecord("[app] button %d pressed", index);
+  void logRecord(const char *format, int32_t arg);
+
   // Implement Print.h wrapper
   virtual size_t write(uint8_t);
   using Print::write;
@@ -70,17 +225,35 @@ public:
   // get climate sensor values
   boolean getClimate(float *temperature, float *humidity);
 
+  // get climate sensor values in tenths of a degree/percent (e.g. 215 = 21.5)
+  boolean getClimateDeci(int16_t *temperature, int16_t *humidity);
+
 private:
+  void _initialiseConfig(void);
   void _initialiseNetwork(byte *mac);
   void _initialiseMqtt(byte *mac);
   void _initialiseRestApi(void);
 
   void _initialiseClimateSensor(void);
+  void _initialiseTelemetrySpool(void);
   void _updateClimateSensor(void);
 
+  void _updateSystemTelemetry(void);
+
   boolean _isNetworkConnected(void);
 
+  void _updateStatusTxt(void);
+  void _dispatchEvents(void);
+  void _drainLogRecords(void);
+
+  boolean _publishTelemetry(JsonVariant json);
+  boolean _batchTelemetry(JsonVariant json);
+  boolean _flushTelemetryBatch(void);
+  void _replayTelemetrySpool(void);
+
   uint32_t _lastClimateUpdate = 0L;
+  uint32_t _lastSystemUpdate = 0L;
+  uint32_t _lastSpoolReplay = 0L;
 };
 
 #endif
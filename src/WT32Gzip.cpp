@@ -0,0 +1,179 @@
+/*
+ * WT32Gzip.cpp
+ */
+
+#include "WT32Gzip.h"
+
+typedef struct
+{
+  uint8_t *out;
+  size_t length;
+  uint32_t bits;
+  uint8_t bitCount;
+} bitWriter_t;
+
+void _writeBits(bitWriter_t *writer, uint32_t value, uint8_t count)
+{
+  writer->bits |= value << writer->bitCount;
+  writer->bitCount += count;
+
+  while (writer->bitCount >= 8)
+  {
+    writer->out[writer->length++] = writer->bits & 0xFF;
+    writer->bits >>= 8;
+    writer->bitCount -= 8;
+  }
+}
+
+// Huffman codes are written most significant bit first
+void _writeHuffman(bitWriter_t *writer, uint32_t code, uint8_t count)
+{
+  uint32_t reversed = 0;
+  for (uint8_t i = 0; i < count; i++)
+  {
+    reversed = (reversed << 1) | ((code >> i) & 1);
+  }
+  _writeBits(writer, reversed, count);
+}
+
+void _writeLiteral(bitWriter_t *writer, uint16_t value)
+{
+  // Fixed Huffman literal/length codes (RFC 1951 section 3.2.6)
+  if (value < 144)
+  {
+    _writeHuffman(writer, 0x30 + value, 8);
+  }
+  else if (value < 256)
+  {
+    _writeHuffman(writer, 0x190 + (value - 144), 9);
+  }
+  else if (value < 280)
+  {
+    _writeHuffman(writer, value - 256, 7);
+  }
+  else
+  {
+    _writeHuffman(writer, 0xC0 + (value - 280), 8);
+  }
+}
+
+void _writeMatch(bitWriter_t *writer, uint16_t length, uint16_t distance)
+{
+  static const uint16_t lengthBase[] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+  static const uint8_t lengthExtra[] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+  static const uint16_t distanceBase[] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+  static const uint8_t distanceExtra[] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+  uint8_t code = 28;
+  while (lengthBase[code] > length)
+  {
+    code--;
+  }
+  _writeLiteral(writer, 257 + code);
+  _writeBits(writer, length - lengthBase[code], lengthExtra[code]);
+
+  code = 29;
+  while (distanceBase[code] > distance)
+  {
+    code--;
+  }
+  _writeHuffman(writer, code, 5);
+  _writeBits(writer, distance - distanceBase[code], distanceExtra[code]);
+}
+
+uint32_t _crc32(const uint8_t *data, size_t length)
+{
+  uint32_t crc = 0xFFFFFFFF;
+  for (size_t i = 0; i < length; i++)
+  {
+    crc ^= data[i];
+    for (uint8_t bit = 0; bit < 8; bit++)
+    {
+      crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+  }
+  return ~crc;
+}
+
+size_t _gzipBound(size_t length)
+{
+  return length + (length / 8) + GZIP_OVERHEAD_BYTES;
+}
+
+size_t _gzipCompress(const uint8_t *in, size_t length, uint8_t *out, ArduinoJson::Allocator *allocator)
+{
+  int32_t *head = (int32_t *)allocator->allocate(GZIP_HASH_SIZE * sizeof(int32_t));
+  if (!head)
+  {
+    return 0;
+  }
+
+  for (uint16_t i = 0; i < GZIP_HASH_SIZE; i++)
+  {
+    head[i] = -1;
+  }
+
+  // Header (magic, deflate, no flags/mtime, unknown OS)
+  static const uint8_t header[] = {0x1F, 0x8B, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF};
+  memcpy(out, header, sizeof(header));
+
+  bitWriter_t writer = {out, sizeof(header), 0, 0};
+
+  // Single final block, fixed Huffman codes
+  _writeBits(&writer, 1, 1);
+  _writeBits(&writer, 1, 2);
+
+  size_t pos = 0;
+  while (pos < length)
+  {
+    uint16_t matchLength = 0;
+    uint16_t matchDistance = 0;
+
+    if (pos + 3 <= length)
+    {
+      uint32_t hash = (uint32_t)((in[pos] << 16 | in[pos + 1] << 8 | in[pos + 2]) * 2654435761UL) >> (32 - GZIP_HASH_BITS);
+      int32_t candidate = head[hash];
+      head[hash] = pos;
+
+      if (candidate >= 0 && (pos - candidate) <= GZIP_WINDOW_BYTES)
+      {
+        size_t maxLength = min(length - pos, (size_t)258);
+        while (matchLength < maxLength && in[candidate + matchLength] == in[pos + matchLength])
+        {
+          matchLength++;
+        }
+        matchDistance = pos - candidate;
+      }
+    }
+
+    if (matchLength >= 3)
+    {
+      _writeMatch(&writer, matchLength, matchDistance);
+      pos += matchLength;
+    }
+    else
+    {
+      _writeLiteral(&writer, in[pos]);
+      pos++;
+    }
+  }
+
+  // End of block, then flush to a byte boundary
+  _writeLiteral(&writer, 256);
+  _writeBits(&writer, 0, 7);
+
+  allocator->deallocate(head);
+
+  // Trailer (CRC32 and input size, little endian)
+  uint32_t crc = _crc32(in, length);
+  for (uint8_t i = 0; i < 4; i++)
+  {
+    out[writer.length++] = (crc >> (i * 8)) & 0xFF;
+  }
+  for (uint8_t i = 0; i < 4; i++)
+  {
+    out[writer.length++] = (length >> (i * 8)) & 0xFF;
+  }
+
+  return writer.length;
+}
@@ -0,0 +1,27 @@
+/*
+ * WT32Gzip.h
+ *
+ * A small single pass deflate encoder (greedy LZ77 matching with fixed
+ * Huffman codes), enough to shrink highly repetitive JSON
+ */
+
+#ifndef WT32_GZIP_H
+#define WT32_GZIP_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Gzip compression of adoption/schema payloads
+#define GZIP_HASH_BITS              12
+#define GZIP_HASH_SIZE              (1 << GZIP_HASH_BITS)
+#define GZIP_WINDOW_BYTES           32768
+#define GZIP_OVERHEAD_BYTES         64
+
+// Worst case compressed size, i.e. for incompressible input
+size_t _gzipBound(size_t length);
+
+// Compresses into out (which must be at least _gzipBound() bytes), returns the
+// compressed size, or zero if we couldn't allocate our match table
+size_t _gzipCompress(const uint8_t *in, size_t length, uint8_t *out, ArduinoJson::Allocator *allocator);
+
+#endif
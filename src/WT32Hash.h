@@ -0,0 +1,34 @@
+/*
+ * WT32Hash.h
+ */
+
+#ifndef WT32_HASH_H
+#define WT32_HASH_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Print sink which FNV-1a hashes everything written, so documents can be
+// hashed by serialising them without needing a buffer
+class FnvHashPrint : public Print
+{
+public:
+  uint32_t hash = 2166136261UL;
+
+  size_t write(uint8_t character)
+  {
+    hash = (hash ^ character) * 16777619UL;
+    return 1;
+  }
+  using Print::write;
+};
+
+// FNV-1a hash of a value's serialised JSON
+inline uint32_t _getValueHash(JsonVariantConst value)
+{
+  FnvHashPrint hash;
+  serializeJson(value, hash);
+  return hash.hash;
+}
+
+#endif
@@ -0,0 +1,136 @@
+/*
+ * WT32Http.cpp
+ */
+
+#include "WT32Http.h"
+
+size_t _readRequestHead(Client &client, char *head, size_t size)
+{
+  size_t length = 0;
+  head[0] = '\0';
+
+  uint32_t start = millis();
+  while (length < size - 1 && client.connected() && (millis() - start) < REST_REQUEST_TIMEOUT_MS)
+  {
+    int available = client.available();
+    if (available <= 0)
+    {
+      yield();
+      continue;
+    }
+
+    int count = client.read((uint8_t *)&head[length], min((size_t)available, size - 1 - length));
+    if (count <= 0)
+    {
+      break;
+    }
+
+    length += count;
+    head[length] = '\0';
+
+    if (strstr(head, "\r\n\r\n"))
+    {
+      break;
+    }
+  }
+
+  return length;
+}
+
+boolean _isRequestFor(const char *head, const char *path)
+{
+  if (strncmp_P(head, PSTR("GET "), 4) != 0)
+  {
+    return false;
+  }
+
+  size_t length = strlen(path);
+  if (strncmp(&head[4], path, length) != 0)
+  {
+    return false;
+  }
+
+  char next = head[4 + length];
+  return next == ' ' || next == '?';
+}
+
+const char *_findRequestHeader(const char *head, const char *name, size_t *valueLength)
+{
+  size_t nameLength = strlen(name);
+
+  for (const char *line = strstr(head, "\r\n"); line; line = strstr(line + 2, "\r\n"))
+  {
+    if (strncasecmp(line + 2, name, nameLength) != 0 || line[2 + nameLength] != ':')
+    {
+      continue;
+    }
+
+    const char *value = line + 3 + nameLength;
+    while (*value == ' ')
+    {
+      value++;
+    }
+
+    const char *end = strstr(value, "\r\n");
+    *valueLength = end ? end - value : strlen(value);
+    return value;
+  }
+
+  return NULL;
+}
+
+boolean _valueContains(const char *value, size_t valueLength, const char *token)
+{
+  size_t tokenLength = strlen(token);
+
+  for (size_t i = 0; i + tokenLength <= valueLength; i++)
+  {
+    if (strncmp(&value[i], token, tokenLength) == 0)
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+boolean _isNotModified(const char *head, const char *etag)
+{
+  size_t length;
+  const char *value = _findRequestHeader(head, "If-None-Match", &length);
+
+  // Values can be a list of (possibly weak) ETags
+  return value && (_valueContains(value, length, etag) || _valueContains(value, length, "*"));
+}
+
+typedef struct
+{
+  const char *extension;
+  const char *contentType;
+} contentType_t;
+
+const contentType_t _contentTypes[] = {
+  {".html", "text/html"},
+  {".css", "text/css"},
+  {".js", "application/javascript"},
+  {".json", "application/json"},
+  {".svg", "image/svg+xml"},
+  {".png", "image/png"},
+  {".ico", "image/x-icon"},
+  {".txt", "text/plain"},
+};
+
+const char *_getContentType(const char *path)
+{
+  const char *extension = strrchr(path, '.');
+
+  for (uint8_t i = 0; extension && i < sizeof(_contentTypes) / sizeof(_contentTypes[0]); i++)
+  {
+    if (strcasecmp(extension, _contentTypes[i].extension) == 0)
+    {
+      return _contentTypes[i].contentType;
+    }
+  }
+
+  return "application/octet-stream";
+}
@@ -0,0 +1,136 @@
+/*
+ * WT32Http.h
+ *
+ * Helpers for peeking at REST request heads, so requests can be answered
+ * (or their headers read) before they are handed on to the API
+ */
+
+#ifndef WT32_HTTP_H
+#define WT32_HTTP_H
+
+#include <Arduino.h>
+#include <Client.h>
+
+// REST request heads are peeked at so conditional GETs can be answered early
+#define REST_REQUEST_HEAD_BYTES     512
+#define REST_REQUEST_TIMEOUT_MS     1000L
+
+// Responses we answer ourselves are sent in chunks of this size, and carry
+// the same CORS headers OXRS_API adds for the browser admin UI
+#define REST_RESPONSE_BUFFER_BYTES  512
+#define REST_CORS_HEADERS           "Access-Control-Allow-Origin: *\r\n" \
+                                    "Access-Control-Allow-Methods: GET, POST, DELETE, OPTIONS\r\n" \
+                                    "Access-Control-Allow-Headers: Content-Type\r\n"
+
+// Wraps a REST client, replaying the request head we have already read
+// before reading anything more from the underlying client
+class PeekedClient : public Client
+{
+public:
+  PeekedClient(Client &client, const uint8_t *head, size_t length) : _client(client), _head(head), _length(length), _position(0) {}
+
+  int connect(IPAddress ip, uint16_t port) { return _client.connect(ip, port); }
+  int connect(const char *host, uint16_t port) { return _client.connect(host, port); }
+  size_t write(uint8_t character) { return _client.write(character); }
+  size_t write(const uint8_t *buffer, size_t size) { return _client.write(buffer, size); }
+  void flush(void) { _client.flush(); }
+  void stop(void) { _client.stop(); }
+  uint8_t connected(void) { return _position < _length || _client.connected(); }
+  operator bool(void) { return connected(); }
+
+  int available(void)
+  {
+    return (_length - _position) + _client.available();
+  }
+
+  int read(void)
+  {
+    return _position < _length ? _head[_position++] : _client.read();
+  }
+
+  int read(uint8_t *buffer, size_t size)
+  {
+    if (_position == _length)
+    {
+      return _client.read(buffer, size);
+    }
+
+    size_t count = min(size, _length - _position);
+    memcpy(buffer, &_head[_position], count);
+    _position += count;
+    return count;
+  }
+
+  int peek(void)
+  {
+    return _position < _length ? _head[_position] : _client.peek();
+  }
+
+private:
+  Client &_client;
+  const uint8_t *_head;
+  size_t _length;
+  size_t _position;
+};
+
+// Collects writes (e.g. serializeJson() output, which is written a byte at a
+// time) into REST_RESPONSE_BUFFER_BYTES chunks, rather than one send per byte
+class BufferedPrint : public Print
+{
+public:
+  BufferedPrint(Print &out) : _out(out), _length(0) {}
+  ~BufferedPrint(void) { flush(); }
+
+  size_t write(uint8_t character)
+  {
+    if (_length == sizeof(_buffer))
+    {
+      flush();
+    }
+
+    _buffer[_length++] = character;
+    return 1;
+  }
+
+  size_t write(const uint8_t *buffer, size_t size)
+  {
+    for (size_t i = 0; i < size; i++)
+    {
+      write(buffer[i]);
+    }
+    return size;
+  }
+
+  void flush(void)
+  {
+    if (_length > 0)
+    {
+      _out.write(_buffer, _length);
+      _length = 0;
+    }
+  }
+
+private:
+  Print &_out;
+  uint8_t _buffer[REST_RESPONSE_BUFFER_BYTES];
+  size_t _length;
+};
+
+// Reads (at most) the request line and headers, returns the length read
+size_t _readRequestHead(Client &client, char *head, size_t size);
+
+// Returns true if the request line is a GET of this path (ignoring any query)
+boolean _isRequestFor(const char *head, const char *path);
+
+// Returns the value of a request header (not NUL terminated), or NULL
+const char *_findRequestHeader(const char *head, const char *name, size_t *valueLength);
+
+boolean _valueContains(const char *value, size_t valueLength, const char *token);
+
+// Returns true if the If-None-Match header matches our ETag (or is a wildcard)
+boolean _isNotModified(const char *head, const char *etag);
+
+// Content type for a file, from its extension
+const char *_getContentType(const char *path);
+
+#endif
@@ -0,0 +1,233 @@
+/*
+ * WT32Ota.cpp
+ */
+
+#include "WT32Ota.h"
+#include <ArduinoJson.h>
+#include <Update.h>       // For OTA firmware updates
+
+typedef struct
+{
+  uint8_t *data;
+  size_t length;
+} otaChunk_t;
+
+// Created once and reused, so the writer task can never outlive them
+QueueHandle_t _otaFullChunks = NULL;
+QueueHandle_t _otaFreeChunks = NULL;
+volatile boolean _otaWriteFailed = false;
+
+// Writes received chunks to flash in its own task, so the next chunk can
+// be received while this one is erased/written, stops on an empty chunk
+void _otaWriterTask(void *parameter)
+{
+  otaChunk_t chunk;
+  while (xQueueReceive(_otaFullChunks, &chunk, portMAX_DELAY) == pdTRUE && chunk.length > 0)
+  {
+    if (!_otaWriteFailed && Update.write(chunk.data, chunk.length) != chunk.length)
+    {
+      _otaWriteFailed = true;
+    }
+    xQueueSend(_otaFreeChunks, &chunk, portMAX_DELAY);
+  }
+  vTaskDelete(NULL);
+}
+
+void _stopOtaWriter(void)
+{
+  otaChunk_t chunk;
+  chunk.data = NULL;
+  chunk.length = 0;
+  xQueueSend(_otaFullChunks, &chunk, portMAX_DELAY);
+}
+
+// Fills a chunk from the request body, returns false if it stalls
+boolean _readOtaChunk(Request &req, otaChunk_t *chunk)
+{
+  size_t wanted = min((size_t)req.left(), (size_t)OTA_BUFFER_BYTES);
+  chunk->length = 0;
+
+  uint32_t lastRead = millis();
+  while (chunk->length < wanted)
+  {
+    int count = req.read(&chunk->data[chunk->length], wanted - chunk->length);
+    if (count > 0)
+    {
+      chunk->length += count;
+      lastRead = millis();
+    }
+    else if ((millis() - lastRead) > OTA_TIMEOUT_MS)
+    {
+      return false;
+    }
+    else
+    {
+      yield();
+    }
+  }
+
+  return true;
+}
+
+// Returns the bytes received, or 0 if receiving stalled
+size_t _streamOta(Request &req, uint8_t *buffer, size_t size)
+{
+  otaChunk_t chunk;
+  for (uint8_t i = 0; i < 2; i++)
+  {
+    chunk.data = &buffer[i * OTA_BUFFER_BYTES];
+    chunk.length = 0;
+    xQueueSend(_otaFreeChunks, &chunk, 0);
+  }
+
+  size_t received = 0;
+  uint8_t held = 0;
+  while (received < size && !_otaWriteFailed)
+  {
+    xQueueReceive(_otaFreeChunks, &chunk, portMAX_DELAY);
+    held++;
+
+    if (!_readOtaChunk(req, &chunk))
+    {
+      received = 0;
+      break;
+    }
+
+    received += chunk.length;
+    xQueueSend(_otaFullChunks, &chunk, portMAX_DELAY);
+    held--;
+  }
+
+  // Wait for the writer to hand back every buffer, then stop it
+  for (uint8_t i = held; i < 2; i++)
+  {
+    xQueueReceive(_otaFreeChunks, &chunk, portMAX_DELAY);
+  }
+  _stopOtaWriter();
+
+  return received;
+}
+
+// Returns false if an md5 query parameter is given but isn't 32 hex digits,
+// otherwise md5 holds it (or is empty if not given)
+boolean _otaQueryMD5(Request &req, char *md5)
+{
+  md5[0] = '\0';
+
+  char value[34];
+  if (!req.query("md5", value, sizeof(value)))
+  {
+    // aWOT reports a value too long for our buffer as missing
+    for (const char *query = req.query(); (query = strstr(query, "md5=")); query++)
+    {
+      if (query == req.query() || query[-1] == '&')
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  if (strlen(value) != 32)
+  {
+    return false;
+  }
+
+  for (uint8_t i = 0; i < 32; i++)
+  {
+    if (!isxdigit(value[i]))
+    {
+      return false;
+    }
+  }
+
+  strcpy(md5, value);
+  return true;
+}
+
+boolean _otaUpdate(Request &req, Response &res, Print &log)
+{
+  int size = req.left();
+  if (size <= 0)
+  {
+    res.sendStatus(411);
+    return false;
+  }
+
+  // Refuse a malformed MD5 rather than flash an image we can't verify
+  char md5[33];
+  if (!_otaQueryMD5(req, md5))
+  {
+    res.status(400);
+    res.print(F("md5 must be 32 hex digits"));
+    return false;
+  }
+
+  if (!_otaFullChunks)
+  {
+    _otaFullChunks = xQueueCreate(2, sizeof(otaChunk_t));
+    _otaFreeChunks = xQueueCreate(2, sizeof(otaChunk_t));
+  }
+
+  // Without a writer task we would block forever waiting for free buffers
+  uint8_t *buffer = (uint8_t *)malloc(OTA_BUFFER_BYTES * 2);
+  if (!buffer || !_otaFullChunks || !_otaFreeChunks ||
+      xTaskCreate(_otaWriterTask, "ota", OTA_TASK_STACK_BYTES, NULL, uxTaskPriorityGet(NULL), NULL) != pdPASS)
+  {
+    free(buffer);
+    res.sendStatus(507);
+    return false;
+  }
+
+  if (!Update.begin(size))
+  {
+    _stopOtaWriter();
+    free(buffer);
+    res.status(500);
+    res.print(Update.errorString());
+    return false;
+  }
+
+  // Optionally verify the image against an MD5 (calculated as it is written)
+  if (md5[0])
+  {
+    Update.setMD5(md5);
+  }
+
+  log.print(F("[wt32] ota update started, bytes: "));
+  log.println(size);
+
+  _otaWriteFailed = false;
+  uint32_t start = millis();
+  size_t received = _streamOta(req, buffer, size);
+  uint32_t elapsed = millis() - start;
+  free(buffer);
+
+  // Update.end() fails if the image is incomplete or the MD5 doesn't match
+  if (received != (size_t)size || _otaWriteFailed || !Update.end())
+  {
+    const char *error = Update.hasError() ? Update.errorString() : "receive timed out";
+    Update.abort();
+
+    log.print(F("[wt32] ota update failed: "));
+    log.println(error);
+
+    res.status(500);
+    res.print(error);
+    return false;
+  }
+
+  uint32_t bytesPerSecond = elapsed ? (uint64_t)received * 1000 / elapsed : received;
+  log.print(F("[wt32] ota update complete, bytes/sec: "));
+  log.println(bytesPerSecond);
+
+  JsonDocument json;
+  json["bytes"] = received;
+  json["durationMs"] = elapsed;
+  json["bytesPerSecond"] = bytesPerSecond;
+  json["md5"] = Update.md5String();
+
+  res.set("Content-Type", "application/json");
+  serializeJson(json, res);
+  return true;
+}
@@ -0,0 +1,24 @@
+/*
+ * WT32Ota.h
+ *
+ * Streaming OTA firmware updates via REST
+ */
+
+#ifndef WT32_OTA_H
+#define WT32_OTA_H
+
+#include <Arduino.h>
+#include <OXRS_API.h>     // For REST API
+
+// OTA firmware updates via REST, double buffered (one flash sector each)
+// so receiving the next chunk overlaps writing the last to flash
+#define OTA_BUFFER_BYTES            4096
+#define OTA_TIMEOUT_MS              5000L
+#define OTA_TASK_STACK_BYTES        4096
+
+// Streams the request body into the inactive partition (optionally verified
+// with ?md5=, 400 if malformed) and responds with the result, logging progress,
+// returns true if the new firmware is ready to restart into
+boolean _otaUpdate(Request &req, Response &res, Print &log);
+
+#endif
@@ -0,0 +1,289 @@
+/*
+ * WT32Schema.cpp
+ */
+
+#include "WT32Schema.h"
+#include "WT32Hash.h"
+#include <OXRS_WT32.h>    // For oxrsKeyHash
+
+uint8_t _getSchemaType(const char *type)
+{
+  static const struct
+  {
+    const char *name;
+    uint8_t types;
+  } schemaTypes[] = {
+      {"object", SCHEMA_TYPE_OBJECT},
+      {"array", SCHEMA_TYPE_ARRAY},
+      {"string", SCHEMA_TYPE_STRING},
+      {"integer", SCHEMA_TYPE_INTEGER},
+      {"number", SCHEMA_TYPE_NUMBER | SCHEMA_TYPE_INTEGER},
+      {"boolean", SCHEMA_TYPE_BOOLEAN},
+      {"null", SCHEMA_TYPE_NULL}};
+
+  for (uint8_t i = 0; type && i < sizeof(schemaTypes) / sizeof(schemaTypes[0]); i++)
+  {
+    if (strcmp(type, schemaTypes[i].name) == 0)
+    {
+      return schemaTypes[i].types;
+    }
+  }
+
+  return 0;
+}
+
+uint8_t _getJsonType(JsonVariantConst value)
+{
+  if (value.is<JsonObjectConst>())
+  {
+    return SCHEMA_TYPE_OBJECT;
+  }
+  else if (value.is<JsonArrayConst>())
+  {
+    return SCHEMA_TYPE_ARRAY;
+  }
+  else if (value.is<const char *>())
+  {
+    return SCHEMA_TYPE_STRING;
+  }
+  else if (value.is<bool>())
+  {
+    return SCHEMA_TYPE_BOOLEAN;
+  }
+  else if (value.is<int64_t>() || value.is<uint64_t>())
+  {
+    return SCHEMA_TYPE_INTEGER;
+  }
+  else if (value.is<double>())
+  {
+    // A float with no fractional part (e.g. 60.0) is still an integer
+    double number = value.as<double>();
+    if (number == floor(number) && fabs(number) <= 9007199254740992.0)
+    {
+      return SCHEMA_TYPE_INTEGER;
+    }
+    return SCHEMA_TYPE_NUMBER;
+  }
+
+  return SCHEMA_TYPE_NULL;
+}
+
+void _countSchema(JsonVariantConst schema, uint16_t *nodeCount, uint16_t *enumCount, uint16_t *keyBytes)
+{
+  (*nodeCount)++;
+  *enumCount += schema["enum"].size();
+
+  for (JsonPairConst kvp : schema["properties"].as<JsonObjectConst>())
+  {
+    *keyBytes += strlen(kvp.key().c_str()) + 1;
+    _countSchema(kvp.value(), nodeCount, enumCount, keyBytes);
+  }
+
+  if (schema["items"].is<JsonObjectConst>())
+  {
+    _countSchema(schema["items"], nodeCount, enumCount, keyBytes);
+  }
+}
+
+void _compileSchemaNode(schemaProgram_t *program, JsonVariantConst schema, const char *key)
+{
+  schemaNode_t *node = &program->nodes[program->nodeCount++];
+
+  // Keys are matched by hash, then compared in full in case of a collision
+  if (key)
+  {
+    node->keyHash = oxrsKeyHash(key);
+    node->keyOffset = program->keyBytes;
+    strcpy(&program->keys[program->keyBytes], key);
+    program->keyBytes += strlen(key) + 1;
+  }
+  else
+  {
+    node->keyHash = 0L;
+    node->keyOffset = 0;
+  }
+  node->flags = 0;
+
+  // Type can be a single type or a list of types (any if not specified)
+  JsonVariantConst type = schema["type"];
+  if (type.is<JsonArrayConst>())
+  {
+    node->types = 0;
+    for (JsonVariantConst t : type.as<JsonArrayConst>())
+    {
+      node->types |= _getSchemaType(t.as<const char *>());
+    }
+  }
+  else
+  {
+    node->types = type.isNull() ? SCHEMA_TYPE_ANY : _getSchemaType(type.as<const char *>());
+  }
+
+  if (!schema["minimum"].isNull())
+  {
+    node->flags |= SCHEMA_HAS_MINIMUM;
+    node->minimum = schema["minimum"].as<float>();
+  }
+
+  if (!schema["maximum"].isNull())
+  {
+    node->flags |= SCHEMA_HAS_MAXIMUM;
+    node->maximum = schema["maximum"].as<float>();
+  }
+
+  if (schema["additionalProperties"].is<bool>() && !schema["additionalProperties"].as<bool>())
+  {
+    node->flags |= SCHEMA_NO_ADDITIONAL;
+  }
+
+  // Enum values are compared by the hash of their serialised JSON
+  node->enumStart = program->enumCount;
+  node->enumCount = 0;
+  for (JsonVariantConst e : schema["enum"].as<JsonArrayConst>())
+  {
+    program->enums[program->enumCount++] = _getValueHash(e);
+    node->enumCount++;
+  }
+
+  // Children follow their parent, properties first then array items
+  for (JsonPairConst kvp : schema["properties"].as<JsonObjectConst>())
+  {
+    _compileSchemaNode(program, kvp.value(), kvp.key().c_str());
+  }
+
+  if (schema["items"].is<JsonObjectConst>())
+  {
+    node->flags |= SCHEMA_HAS_ITEMS;
+    _compileSchemaNode(program, schema["items"], NULL);
+  }
+
+  node->next = program->nodeCount;
+}
+
+void _compileSchema(schemaProgram_t *program, JsonVariantConst schema, ArduinoJson::Allocator *allocator)
+{
+  allocator->deallocate(program->nodes);
+  allocator->deallocate(program->enums);
+  allocator->deallocate(program->keys);
+  memset(program, 0, sizeof(schemaProgram_t));
+
+  uint16_t nodeCount = 0;
+  uint16_t enumCount = 0;
+  uint16_t keyBytes = 1;
+  _countSchema(schema, &nodeCount, &enumCount, &keyBytes);
+
+  program->nodes = (schemaNode_t *)allocator->allocate(nodeCount * sizeof(schemaNode_t));
+  program->enums = (uint32_t *)allocator->allocate(enumCount * sizeof(uint32_t) + 1);
+  program->keys = (char *)allocator->allocate(keyBytes);
+  if (!program->nodes || !program->enums || !program->keys)
+  {
+    // Nothing to validate against
+    program->nodeCount = 0;
+    return;
+  }
+
+  // The root and array items have no key, so point at the empty first one
+  program->keys[0] = '\0';
+  program->keyBytes = 1;
+
+  _compileSchemaNode(program, schema, NULL);
+}
+
+boolean _validateSchemaNode(const schemaProgram_t *program, uint16_t index, JsonVariantConst value)
+{
+  const schemaNode_t *node = &program->nodes[index];
+
+  uint8_t type = _getJsonType(value);
+  if (!(node->types & type))
+  {
+    return false;
+  }
+
+  if (type & (SCHEMA_TYPE_INTEGER | SCHEMA_TYPE_NUMBER))
+  {
+    float number = value.as<float>();
+    if ((node->flags & SCHEMA_HAS_MINIMUM) && number < node->minimum)
+    {
+      return false;
+    }
+    if ((node->flags & SCHEMA_HAS_MAXIMUM) && number > node->maximum)
+    {
+      return false;
+    }
+  }
+
+  if (node->enumCount > 0)
+  {
+    uint32_t hash = _getValueHash(value);
+    uint16_t i = 0;
+    while (i < node->enumCount && program->enums[node->enumStart + i] != hash)
+    {
+      i++;
+    }
+
+    if (i == node->enumCount)
+    {
+      return false;
+    }
+  }
+
+  if (type == SCHEMA_TYPE_OBJECT)
+  {
+    for (JsonPairConst kvp : value.as<JsonObjectConst>())
+    {
+      const char *key = kvp.key().c_str();
+      uint32_t keyHash = oxrsKeyHash(key);
+
+      // Find the property schema, walking the direct children via their sibling links
+      uint16_t child = index + 1;
+      while (child < node->next &&
+             (program->nodes[child].keyHash != keyHash || strcmp(&program->keys[program->nodes[child].keyOffset], key) != 0))
+      {
+        child = program->nodes[child].next;
+      }
+
+      if (child < node->next)
+      {
+        if (!_validateSchemaNode(program, child, kvp.value()))
+        {
+          return false;
+        }
+      }
+      else if (node->flags & SCHEMA_NO_ADDITIONAL)
+      {
+        return false;
+      }
+    }
+  }
+
+  if (type == SCHEMA_TYPE_ARRAY && (node->flags & SCHEMA_HAS_ITEMS))
+  {
+    // Items schema is the last child
+    uint16_t child = index + 1;
+    while (program->nodes[child].next < node->next)
+    {
+      child = program->nodes[child].next;
+    }
+
+    for (JsonVariantConst item : value.as<JsonArrayConst>())
+    {
+      if (!_validateSchemaNode(program, child, item))
+      {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+boolean _validateSchema(const schemaProgram_t *program, JsonVariantConst value)
+{
+  // Accept anything if we have no schema
+  if (program->nodeCount == 0)
+  {
+    return true;
+  }
+
+  return _validateSchemaNode(program, 0, value);
+}
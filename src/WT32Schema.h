@@ -0,0 +1,57 @@
+/*
+ * WT32Schema.h
+ *
+ * Config/command schemas compiled to a flat program of nodes, which inbound
+ * payloads can be validated against without walking the schema JSON
+ */
+
+#ifndef WT32_SCHEMA_H
+#define WT32_SCHEMA_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+typedef struct
+{
+  uint32_t keyHash;     // property key hash (0 for the root/array items)
+  uint16_t keyOffset;   // property key offset into the program keys
+  uint8_t types;        // SCHEMA_TYPE_* bitmask of allowed types
+  uint8_t flags;        // SCHEMA_HAS_* flags
+  uint16_t next;        // index of the next sibling (i.e. skips this subtree)
+  float minimum;
+  float maximum;
+  uint16_t enumStart;   // index of first enum value hash
+  uint16_t enumCount;
+} schemaNode_t;
+
+typedef struct
+{
+  schemaNode_t *nodes;
+  uint16_t nodeCount;
+  uint32_t *enums;
+  uint16_t enumCount;
+  char *keys;           // property keys, null terminated, the first is empty
+  uint16_t keyBytes;
+} schemaProgram_t;
+
+#define SCHEMA_TYPE_OBJECT          0x01
+#define SCHEMA_TYPE_ARRAY           0x02
+#define SCHEMA_TYPE_STRING          0x04
+#define SCHEMA_TYPE_INTEGER         0x08
+#define SCHEMA_TYPE_NUMBER          0x10
+#define SCHEMA_TYPE_BOOLEAN         0x20
+#define SCHEMA_TYPE_NULL            0x40
+#define SCHEMA_TYPE_ANY             0xFF
+
+#define SCHEMA_HAS_MINIMUM          0x01
+#define SCHEMA_HAS_MAXIMUM          0x02
+#define SCHEMA_HAS_ITEMS            0x04
+#define SCHEMA_NO_ADDITIONAL        0x08
+
+// (Re)compiles the schema, allocating the program from the allocator
+void _compileSchema(schemaProgram_t *program, JsonVariantConst schema, ArduinoJson::Allocator *allocator);
+
+// Returns true if the value is valid (or the program is empty)
+boolean _validateSchema(const schemaProgram_t *program, JsonVariantConst value);
+
+#endif